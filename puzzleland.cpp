@@ -7,1433 +7,5052 @@
 
 #include <cstdio>		// For printf.
 #include <cstdint>		// For uint16_t and the like.
+#include <cstring>		// For memset and strcmp.
+#include <cerrno>		// For errno.
 #include <termios.h>	// For editing terminal settings.
+#include <sys/ioctl.h>	// For the terminal's size.
 #include <unistd.h>
+#include <poll.h>		// For checking whether the terminal can take another frame.
+#include <csignal>		// For restoring the terminal when killed.
+#include <cstdlib>		// For atexit.
+#include <ctime>		// For clock_gettime.
+#include <thread>		// For running one server loop per core.
+#include <mutex>
+#include <condition_variable>	// For waking the prefetcher.
+#include <vector>
+#include <algorithm>	// For sorting places by id.
+#include <map>	// For the tiles a room variant changes.
+#include <unordered_map>	// For finding tiles the room compiler has already stored.
+#include <memory>		// For unique_ptr.
+#include <sys/socket.h>	// For server mode.
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <fcntl.h>		// For opening the room atlas.
+#include <sys/mman.h>	// For mapping it in.
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/timerfd.h>	// For ticking in real-time mode.
+#include <sys/resource.h>	// For measuring its CPU use.
+#endif
 
 
-// A few global variables.
-char board[3200];	// Grid representing  current room.
-uint8_t height;		// Height of current room.
-uint8_t width;		// Width of current room.
-uint8_t flags;		// Used as an array of boolean status flags.
-char input;			// User input.
+// Rooms are stored in square tiles, so a big room only takes memory where something is in it.
+// The board has two layers of them. The terrain is how a room starts out, packed two cells to a
+// byte as indices into terrainGlyphs. It never changes, so every game in the room shares it.
+// Pieces (the player, blocks, '!'s, anything that isn't in terrainGlyphs) and every change are
+// put in tiles of the game's own on top. A game only has its own copy of a tile once something
+// is put in it, so resetting a room means dropping those and putting its pieces back.
+const uint8_t tileShift = 6;					// Tiles are 64x64.
+const uint16_t tileSide = 1 << tileShift;
+const uint16_t tileCells = tileSide * tileSide;
+const uint16_t terrainBytes = tileCells / 2;	// Size of a packed terrain tile.
+const uint16_t maxSide = 10240;					// Widest and tallest a room can be.
+const uint16_t builtCells = 3200;				// Most cells a room built by an initializer can have.
+const char terrainGlyphs[] = " -wWaAsSdD*+ocm?";	// Index 0 is what a blank tile holds.
 
 
-// Print the current room to the screen.
-void print() {
+// Something in a room that isn't terrain, as the room starts out. The room atlas stores these as they are.
+struct Piece {
+	uint32_t position;
+	char glyph;
+	uint8_t padding[3];
+};
 
-	// Clear the screen.
-	printf("\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n");
 
-	// Print the room.
-	for (uint8_t i = 0; i < height; i++) {
-		for (uint8_t j = 0; j < width; j++) {
-			if ((flags & 0x20) == 0x20 && board[width * i + j] == 'X') {
-				printf("Y");
-			}
-			else {
-				printf("%c", board[width * i + j]);
+// Kinds of entity, the things a room moves around. Each turn the entities that are due are
+// updated a kind at a time, in this order, so the numbers are also the update order.
+// Every kind works from its entity's position, so a room can have as many of each as it likes.
+const uint8_t kindChange = 0;	// Spawns a column of 'B's down from its position once the '?' is hit.
+const uint8_t kindButton = 1;	// Blinks the '?' at its position and opens a door 8 cells on once it's hit.
+const uint8_t kindReveal = 2;	// Opens a 'w' door at its position and an 's' door 84 cells on once the '?' is hit.
+const uint8_t kindKnight = 3;	// Walls up the door at its position and opens an 'a' door 120 cells back once the '?' is hit.
+const uint8_t kindDanger = 4;	// A '!' waddling between its position and the cell after.
+const uint8_t kindDestroy = 5;	// A wall of '!'s rising from the row above its position to the top of the room.
+const uint8_t kindChase = 6;	// A '!' moving towards the player.
+const uint8_t kindCopy = 7;		// A '!' making the player's moves.
+const uint8_t kindKillHor = 8;	// A column of '!'s sweeping sideways across the kill band at its position.
+const uint8_t kindKillVert = 9;	// A row of '!'s sweeping up or down the kill band at its position.
+const uint8_t kindCount = 10;
+const uint8_t signalKinds = 4;	// The kinds before this one are told when the player hits a '?'.
+const uint16_t triggeredKinds = 1 << kindChange | 1 << kindReveal | 1 << kindKnight;	// Kinds that only do something then.
+const char *const kindNames[kindCount] = {"change", "button", "reveal", "knight", "danger", "destroy", "chase", "copy", "killHor", "killVert"};
+
+// The band a killHor or killVert sweeps has its top left corner at the entity's position. Its
+// state is how far along the wall of '!'s is, shifted up by killAlongShift, plus killForward
+// while it's going right or down.
+const uint16_t killWidth = 78;
+const uint16_t killHeight = 10;
+const uint8_t killAlongShift = 1;
+const uint32_t killForward = 1;
+
+
+// The entities of a room as a structure of arrays. Entities are kept sorted by kind, so
+// each kind is one run of the arrays and is updated by a loop over it, without a call per entity.
+struct Entities {
+	std::vector<uint32_t> position;	// Where each entity is. What that means depends on the kind.
+	std::vector<uint32_t> state;	// Anything else it keeps, such as which way it's going. 0 to start with.
+	uint32_t first[kindCount + 1];	// Where each kind's run starts. The last one is the number of entities.
+};
+
+
+// Which chasers and copiers are on which cells. The board only has one glyph per cell, so when
+// two of them meet they share a '!', and it's this that says whether one is still left when the
+// other moves off. A hash table of the cells with any of them on, each with a chain through next
+// and prev of the ones there, so any number can pile up on a cell and still leave it in one step. One whose '!' was written over by something else is out of it until a '!'
+// is written back on its cell.
+const uint32_t noEntity = 0xFFFFFFFF;
+const uint32_t notPlaced = 0xFFFFFFFE;
+struct Occupancy {
+	std::vector<uint32_t> cells;	// The cell in each slot, or noEntity for an empty slot. A power of two of them.
+	std::vector<uint32_t> first;	// The first entity on the cell in each slot.
+	std::vector<uint32_t> next;		// For each entity, the next one on its cell, noEntity after the last, or notPlaced.
+	std::vector<uint32_t> prev;		// For each entity, the one before it on its cell, or noEntity for the first.
+	uint8_t shift;		// How far to shift a cell's hash down to get its slot.
+};
+
+
+// When entities are next updated, so a turn only pays for the ones with something to do.
+// Entities of triggeredKinds wait in triggered for the player to hit a '?' and are due the
+// turn after. Every other entity is due the first turn, and puts itself back in for the next one
+// each time it's updated. One that's done for good doesn't.
+struct Schedule {
+	std::vector<uint32_t> next;		// Indices of the entities due next turn, in order.
+	std::vector<uint32_t> triggered;	// Indices of the entities waiting for a '?'.
+	std::vector<uint32_t> due;		// Indices of the entities being updated this turn, in order.
+	bool fired;			// A '?' was hit, so the entities in triggered are due next turn.
+};
+
+
+// Chasers find their way to the player down a field of steps from the player, worked out by a
+// breadth-first search over the cells they can move into. The field only covers a window of the
+// room around the player, so it costs the same in any room. The window is flowRadius each way
+// from the player and stays put until they're within flowRadius / 2 of one of its edges that
+// isn't the room's. The search stops once it has reached every chaser, and is kept from turn to
+// turn until the player moves. A search that runs out of cells first has found everywhere the
+// player can get to in the window, so those cells are marked as a region, and until the window or
+// a wall changes, chasers outside the player's region aren't searched for again. Chasers the
+// search doesn't reach head straight for the player.
+const uint16_t flowRadius = 128;
+const uint16_t flowBlocked = 0xFFFD;	// A wall. Every steps value from here up means the cell wasn't reached.
+const uint16_t flowWanted = 0xFFFE;		// A chaser's cell the search hasn't got to yet.
+const uint16_t flowUnseen = 0xFFFF;
+const uint32_t flowNowhere = 0xFFFFFFFF;
+struct FlowField {
+	std::vector<uint32_t> steps;	// Steps from the player to each cell of the window, row by row, under the search they're from.
+	std::vector<uint32_t> queue;	// Cells of the window the search has reached, in the order it did.
+	std::vector<uint64_t> walls;	// Solid bits of the rows of the window searches have been in, a word per 64 cells.
+	std::vector<uint16_t> wallsFrom;	// Which layout each row of walls was read for.
+	std::vector<uint32_t> regions;	// The region of each cell of the window, as its layout and the search that found it.
+	uint32_t head;		// How far through queue the search has got.
+	uint32_t tail;
+	uint32_t from;		// Where the player was for the search, or flowNowhere before the first one in a room.
+	uint32_t region;	// The player's region, or 0 if no search from it has run out of cells yet.
+	uint32_t walled;	// The Game's wallChanges when the layout started.
+	uint16_t search;	// Counts the searches, so that entries left over from earlier ones can be told apart.
+	uint16_t layout;	// Counts the windows and the walls they've had, the same way.
+	uint16_t left;		// Where the window is in the room.
+	uint16_t top;
+	uint16_t width;
+	uint16_t height;
+};
+
+
+// Everything the simulation of one game works on.
+struct Game {
+	std::vector<const uint8_t*> terrain;	// Every terrain tile of the room, row by row.
+	std::shared_ptr<const std::vector<uint8_t>> terrainOwner;	// Keeps a cached room's terrain around while it's in use.
+	std::vector<char*> ownTiles;	// Tiles the game has put something in, nullptr where it hasn't. They hide the terrain.
+	std::vector<std::unique_ptr<char[]>> tilePool;	// Tiles allocated so far, reused from room to room.
+	uint32_t tilesUsed;		// Tiles of tilePool the current room uses.
+	std::vector<uint64_t*> tileBits;	// Which cells of every tile are solid (see tileBitsOf), nullptr until something asks.
+	std::vector<std::unique_ptr<uint64_t[]>> bitsPool;	// Solid bits allocated so far, reused from room to room.
+	uint32_t bitsUsed;		// Solid bits of bitsPool the current room uses.
+	uint32_t wallChanges;	// Counts writes that changed solid bits, so the flow field knows its walls are out of date.
+	uint16_t tilesAcross;	// Tiles per row of the room.
+	uint64_t widthInverse;	// 2^40 / width, rounded up, for finding a position's row without dividing.
+	uint16_t height;	// Height of current room.
+	uint16_t width;		// Width of current room.
+	uint8_t flags;		// Used as an array of boolean status flags.
+	char input;			// User input.
+	uint16_t viewLeft;		// Room column shown at the left edge of the screen.
+	uint16_t viewTop;		// Room row shown at the top of the screen.
+	uint8_t viewWidth;		// Columns of the room shown.
+	uint8_t viewHeight;		// Rows of the room shown.
+	uint64_t dirtyRows;		// Bit i is set if row i of the view changed since the last frame.
+	uint8_t dirtyFirst[64];	// First changed column of each dirty row of the view.
+	uint8_t dirtyLast[64];	// Last changed column of each dirty row of the view.
+	uint32_t position;	// Where the player is.
+	uint32_t warp;		// Where the warp point is, 0 if it hasn't been placed.
+	uint32_t roomNum;	// Id of the current room's place in the world.
+	char entrance;		// Door the current room was entered through, for resetting it.
+	uint32_t moves;		// Keys acted on so far.
+	Entities entities;	// What the room moves around.
+	Schedule schedule;	// When each entity is next updated.
+	Occupancy occupancy;	// Which chasers and copiers are where.
+	FlowField flow;		// Where chasers go this turn.
+	uint32_t teleport[2];	// The two '*'s of the room, which lead to each other.
+};
+
+
+// Rooms bigger than the screen are shown through a camera that follows the player.
+// The view is at most 64 rows (one bit each in dirtyRows) of 255 columns.
+const uint8_t maxViewWidth = 255;
+const uint8_t maxViewHeight = 64;
+const uint8_t defaultViewWidth = 80;	// What fits when the screen size isn't known (pipes and sockets).
+const uint8_t defaultViewHeight = 40;
+const uint8_t messageRows = 4;			// Rows kept free below the view for messages.
+
+
+// What a terminal is showing of a game, so a frame only has to send what changed.
+struct Screen {
+	std::vector<char> shown;	// The view as it is currently displayed, fitWidth by fitHeight at most.
+	uint8_t shownHeight;	// Height of the displayed view. 0 means the screen has to be redrawn.
+	uint8_t shownWidth;		// Width of the displayed view.
+	uint16_t shownLeft;		// Where in the room the displayed view is.
+	uint16_t shownTop;
+	uint8_t fitWidth;		// Biggest view the screen has room for.
+	uint8_t fitHeight;
+	char shownPlayer;		// Glyph the player is displayed as.
+	bool crlf;				// Lines end in "\r\n" because nothing translates "\n" on the way (sockets).
+};
+
+
+// Room frames are composed into buffers of this size: a full redraw of the largest view plus some slack.
+const uint16_t frameSize = maxViewHeight * (maxViewWidth + 2) + 64;
+
+
+// A few global variables.
+Screen terminal;		// What our own terminal is showing.
+char frame[frameSize];	// Output buffer for one frame on our own terminal.
+bool framePending;		// The newest frame is waiting for the terminal to drain.
+char keys[256];			// Ring buffer of raw input that hasn't been acted on yet.
+uint32_t keysRead;		// Bytes taken out of keys so far.
+uint32_t keysWritten;	// Bytes put into keys so far.
+bool inputClosed;		// The terminal won't send any more input.
+uint64_t keysArrived;	// When the oldest key not shown on screen yet was read, 0 if there isn't one.
+uint32_t framesSkipped;		// Frames that weren't drawn because more keys were already waiting.
+uint32_t latencyFrames;		// Frames that showed the effect of new keys.
+uint64_t latencyTotal;		// Microseconds from reading keys to showing their effect, summed over those frames.
+uint64_t latencyMax;		// Longest of those delays.
+uint32_t tickRate;			// Turns per second in real-time mode, 0 when the game waits for keys.
+uint64_t ticksRun;			// Ticks of the real-time clock so far.
+uint64_t ticksMissed;		// Ticks that came due before the one before them was handled.
+uint64_t tickLateTotal;		// Microseconds from when each tick was due to when it was handled, summed.
+uint64_t tickLateMax;		// Latest of those.
+uint64_t tickCpu;			// Microseconds of CPU time used in real-time mode.
+uint64_t tickWall;			// Microseconds spent in real-time mode.
+termios savedTerminal;	// Terminal settings to restore on exit.
+termios rawTerminal;	// The settings the game plays with, to go back to after being stopped.
+bool terminalChanged;	// The terminal is in raw mode.
+bool onAltScreen;		// The alternate screen is in use.
+volatile sig_atomic_t resized;	// The terminal changed size and the view has to be fitted to it again.
+
+
+// Write all of buf to the terminal, retrying on short writes.
+void flush(const char *buf, size_t length) {
+	while (length > 0) {
+		ssize_t written = write(STDOUT_FILENO, buf, length);
+		if (written < 0) {
+			if (errno == EINTR) {
+				continue;
 			}
+			return;
 		}
-		printf("\n");
+		buf += written;
+		length -= written;
 	}
 }
 
 
-// Change terminal settings to get one character of input at a time.
-termios noCanon() {
-	struct termios oldt, newt;
-	tcgetattr(STDIN_FILENO, &oldt);				// Save old settings to a variable.
-	newt = oldt;								// Copy setting variable.
-	newt.c_lflag &= ~(ICANON | ECHO);			// Change setting variable.
-	tcsetattr(STDIN_FILENO, TCSANOW, &newt);	// Apply change.
-	return oldt;
+// Current time in microseconds, for measuring latency.
+uint64_t now() {
+	timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (uint64_t) t.tv_sec * 1000000 + t.tv_nsec / 1000;
 }
 
 
-// Make a horizontal line of c.
-void horizontal(uint16_t start, uint8_t length, char c) {
-	for (uint8_t i = 0; i < length; i++) {
-		board[start + i] = c;
+// A tile of nothing but ' ', in both layers.
+struct BlankTile {
+	char cells[tileCells];
+	uint8_t terrain[terrainBytes];
+	BlankTile() {
+		memset(cells, ' ', tileCells);
+		memset(terrain, 0, terrainBytes);
 	}
-}
+} blankTile;
 
 
-// Make a vertical line of c.
-void vertical(uint16_t start, uint16_t length, char c) {
-	length *= width;
-	for (uint16_t i = 0; i < length; i += width) {
-		board[start + i] = c;
+// Index of each glyph in terrainGlyphs, or noTerrain if it isn't terrain, and the two glyphs
+// each byte of a packed tile unpacks to.
+const uint8_t noTerrain = 16;
+struct TerrainCodes {
+	uint8_t codes[256];
+	char pairs[256][2];
+	TerrainCodes() {
+		memset(codes, noTerrain, sizeof(codes));
+		for (uint16_t i = 0; i < 256; i++) {
+			codes[(uint8_t) terrainGlyphs[i & 15]] = i & 15;
+			pairs[i][0] = terrainGlyphs[i & 15];
+			pairs[i][1] = terrainGlyphs[i >> 4];
+		}
 	}
-}
+} terrainCodes;
 
 
-// Make a /diagonal line of c.
-void leftDiag(uint16_t start, uint16_t length, char c) {
-	length *= width - 1;
-	for (uint16_t i = 0; i < length; i += width - 1) {
-		board[start + i] = c;
-	}	
-}
-
+// What each glyph does to things moving into it. A new glyph only needs a line in CellTraits.
+const uint8_t traitSolid = 0x01;		// Stops the player, blocks and '!'s.
+const uint8_t traitPushable = 0x02;		// Moves ahead of the player.
+const uint8_t traitLethal = 0x04;		// Kills the player.
+const uint8_t traitDoor = 0x08;			// Leads to another room.
+const uint8_t traitPickup = 0x10;		// Does something when the player steps on it.
+const uint8_t traitTeleporter = 0x20;	// Sends the player on from the other '*' of the room.
+const uint8_t traitClear = 0x40;		// A '!' copying the player can move into it.
+const uint8_t stopsBlocks = traitSolid | traitPushable | traitDoor;
 
-// Make a \diagonal line of c.
-void rightDiag(uint16_t start, uint16_t length, char c) {
-	length *= width + 1;
-	for (uint16_t i = 0; i < length; i += width + 1) {
-		board[start + i] = c;
-	}	
-}
+// Where the walls are is also kept as a bitboard, so the flow field can read a row of walls a word
+// at a time. Each tile has a 64-bit word per row with bit x set if the cell in column x is solid.
+// It's the only trait anything asks about more than a cell at a time.
+struct CellTraits {
+	uint8_t of[256];
+	CellTraits() {
+		memset(of, 0, sizeof(of));
+		of[(uint8_t) '-'] = traitSolid;
+		of[(uint8_t) 'B'] = traitPushable;
+		of[(uint8_t) '!'] = traitLethal | traitClear;
+		for (const char *door = "wWaAsSdD"; *door != '\0'; door++) {
+			of[(uint8_t) *door] = traitDoor;
+		}
+		of[(uint8_t) '?'] = traitPickup;
+		of[(uint8_t) '+'] = traitPickup;
+		of[(uint8_t) 'c'] = traitPickup;
+		of[(uint8_t) 'o'] = traitPickup;
+		of[(uint8_t) '*'] = traitTeleporter;
+		of[(uint8_t) ' '] = traitClear;
+		of[(uint8_t) 'X'] = traitClear;
+	}
+} cellTraits;
 
 
-// Make a horizontal wall.
-void horizontalWall(uint16_t start, uint8_t length) {
-	horizontal(start, length, '-');
+// The terrain at offset in a packed tile.
+inline char terrainAt(const uint8_t *tile, uint32_t offset) {
+	return terrainGlyphs[(tile[offset >> 1] >> ((offset & 1) << 2)) & 15];
 }
 
-// Make a vertical wall.
-void verticalWall(uint16_t start, uint16_t length) {
-	vertical(start, length, '-');
-}
 
-// Make a /diagonal wall.
-void leftDiagWall(uint16_t start, uint16_t length) {
-	leftDiag(start, length, '-');
+// Set the terrain at offset in a packed tile to code.
+inline void setTerrain(uint8_t *tile, uint32_t offset, uint8_t code) {
+	uint8_t shift = (offset & 1) << 2;
+	tile[offset >> 1] = (tile[offset >> 1] & ~(15 << shift)) | code << shift;
 }
 
-// Make a \diagonal wall.
-void rightDiagWall(uint16_t start, uint16_t length) {
-	rightDiag(start, length, '-');
+
+// The cell in column x of row y.
+inline char cellAt(const Game &game, uint16_t x, uint16_t y) {
+	uint32_t index = (y >> tileShift) * game.tilesAcross + (x >> tileShift);
+	uint32_t offset = ((y & (tileSide - 1)) << tileShift) + (x & (tileSide - 1));
+	const char *own = game.ownTiles[index];
+	return own != nullptr ? own[offset] : terrainAt(game.terrain[index], offset);
 }
 
 
-// Make walls around the edge of the room and empty the middle.
-void edgeWalls() {
+// The row pos is in. Exact for every position in a room no wider or taller than maxSide.
+inline uint16_t rowOf(const Game &game, uint32_t pos) {
+	return (pos * game.widthInverse) >> 40;
+}
 
-	horizontalWall(0, width);	// Top wall.
 
-	// Side walls.
-	uint8_t i;
-	for (i = 1; i < (height - 1); i++) {
-		board[i * width] = '-';
-		for (uint8_t j = 1; j < width - 1; j++) {
-			board[width * i + j] = ' ';
-		}
-		board[width * (i + 1) - 1] = '-';
+// The cell at pos. Anything outside the room reads as wall.
+inline char cell(const Game &game, uint32_t pos) {
+	if (pos >= (uint32_t) game.width * game.height) {
+		return '-';
 	}
+	uint16_t y = rowOf(game, pos);
+	return cellAt(game, pos - (uint32_t) y * game.width, y);
+}
 
-	horizontalWall(width * (height - 1), width);	// Bottom wall.
+
+// The traits of the cell at pos.
+inline uint8_t traits(const Game &game, uint32_t pos) {
+	return cellTraits.of[(uint8_t) cell(game, pos)];
 }
 
 
-// Sets *newPosition to be a knight's move away from position.
-void moveKnight(uint16_t position, uint16_t *newPosition) {
-	switch(input) {
-		case 'y':
-			if (position % width > 1) {
-				*newPosition -= (2 + width);
-			}
-			break;
-		case 'u':
-			if (position > 2 * width) {
-				*newPosition -= (1 + 2 * width);
-			}
-			break;
-		case 'i':
-			if (position > 2 * width) {
-				*newPosition += (1 - 2 * width);
-			}
-			break;
-		case 'o':
-			if (position % width < width - 2) {
-				*newPosition += (2 - width);
-			}
-			break;
-		case 'h':
-			if (position % width > 1) {
-				*newPosition += (width - 2);
-			}
-			break;
-		case 'j':
-			if (position < width * (height - 2)) {
-				*newPosition += (2 * width - 1);
-			}
-			break;
-		case 'k':
-			if (position < width * (height - 2)) {
-				*newPosition += (2 * width + 1);
-			}
-			break;
-		case 'l':
-			if (position % width < width - 2) {
-				*newPosition += (2 + width);
+// Give the game its own tile index, holding the terrain under it, so it can be written to.
+// Only the part of the tile inside the room is filled in.
+char *ownTile(Game &game, uint32_t index) {
+	if (game.tilesUsed == game.tilePool.size()) {
+		game.tilePool.emplace_back(new char[tileCells]);
+	}
+	char *tile = game.tilePool[game.tilesUsed++].get();
+	const uint8_t *terrain = game.terrain[index];
+	uint16_t left = index % game.tilesAcross * tileSide;
+	uint16_t top = index / game.tilesAcross * tileSide;
+	uint16_t width = game.width - left < tileSide ? game.width - left : tileSide;
+	uint16_t height = game.height - top < tileSide ? game.height - top : tileSide;
+	if (terrain == blankTile.terrain) {
+		memset(tile, ' ', height << tileShift);
+	}
+	else {
+		for (uint16_t y = 0; y < height; y++) {
+			const uint8_t *packed = terrain + (y << (tileShift - 1));
+			char *row = tile + (y << tileShift);
+			for (uint16_t x = 0; x < width; x += 2) {
+				memcpy(row + x, terrainCodes.pairs[packed[x >> 1]], 2);
 			}
+		}
 	}
+	game.ownTiles[index] = tile;
+	return tile;
 }
 
 
-// Clears the space something was at if it hasn't already been overwritten.
-void clear(uint16_t pos, char old) {
-	if (board[pos] == old) {
-		board[pos] = ' ';
+// Set the cells in mask of row y of tile index's solid bits to whether c is solid, if it has them yet.
+inline void markBits(Game &game, uint32_t index, uint16_t y, uint64_t mask, char c) {
+	uint64_t *bits = game.tileBits[index];
+	if (bits == nullptr) {
+		return;
 	}
+	uint64_t word = (bits[y] & ~mask) | (mask & -(uint64_t) (cellTraits.of[(uint8_t) c] & traitSolid));
+	game.wallChanges += word != bits[y];
+	bits[y] = word;
 }
 
 
-// Moves the '!' at *pos one space towards x.
-void chase(uint32_t *pos, uint16_t x) {
-	if (board[*pos] == '!') {
-		board[*pos] = ' ';
+// Set cell pos to c without recording the change. Putting what's already there in a shared tile doesn't copy it.
+// Writes outside the room are dropped, the same way reads there see a wall.
+inline void setCell(Game &game, uint32_t pos, char c) {
+	if (pos >= (uint32_t) game.width * game.height) {
+		return;
+	}
+	uint16_t y = rowOf(game, pos);
+	uint16_t x = pos - (uint32_t) y * game.width;
+	uint32_t index = (y >> tileShift) * game.tilesAcross + (x >> tileShift);
+	uint32_t offset = ((y & (tileSide - 1)) << tileShift) + (x & (tileSide - 1));
+	char *tile = game.ownTiles[index];
+	if (tile == nullptr) {
+		if (terrainAt(game.terrain[index], offset) == c) {
+			return;
+		}
+		tile = ownTile(game, index);
+	}
+	tile[offset] = c;
+	markBits(game, index, y & (tileSide - 1), (uint64_t) 1 << (x & (tileSide - 1)), c);
+}
 
-		// Calculate the horizontal position of *pos and x.
-		uint8_t xHor = x % width;
-		uint8_t posHor = (*pos) % width;
 
-		// Figure out where '!' needs to move to.
-		uint32_t newPos = *pos;
-		if (xHor > posHor) {
-			newPos++;
+// Set length cells from pos on to c without recording the change, a run at a time.
+void fillCells(Game &game, uint32_t pos, uint32_t length, char c) {
+	uint16_t y = rowOf(game, pos);
+	uint16_t x = pos - (uint32_t) y * game.width;
+	while (length > 0 && y < game.height) {
+		uint32_t index = (y >> tileShift) * game.tilesAcross + (x >> tileShift);
+		uint32_t offset = ((y & (tileSide - 1)) << tileShift) + (x & (tileSide - 1));
+		uint32_t run = tileSide - (x & (tileSide - 1));
+		if (run > (uint32_t) game.width - x) {
+			run = game.width - x;
 		}
-		else if (xHor < posHor) {
-			newPos--;
+		if (run > length) {
+			run = length;
 		}
-		else if (x > *pos) {
-			newPos += width;
+		char *tile = game.ownTiles[index];
+		if (tile == nullptr) {
+			uint32_t same = 0;
+			while (same < run && terrainAt(game.terrain[index], offset + same) == c) {
+				same++;
+			}
+			if (same < run) {
+				tile = ownTile(game, index);
+			}
 		}
-		else {
-			newPos -= width;
+		if (tile != nullptr) {
+			memset(tile + offset, c, run);
+			uint64_t mask = run == tileSide ? ~(uint64_t) 0 : (((uint64_t) 1 << run) - 1) << (x & (tileSide - 1));
+			markBits(game, index, y & (tileSide - 1), mask, c);
 		}
-
-		// Check if there's a wall in the way.
-		if (board[newPos] != '-') {
-			*pos = newPos;
+		length -= run;
+		x += run;
+		if (x == game.width) {
+			x = 0;
+			y++;
 		}
+	}
+}
+
+
+// Empty the board for a width by height room. The tiles of the last room go back in the pool.
+void resizeBoard(Game &game, uint16_t width, uint16_t height) {
+	game.width = width;
+	game.height = height;
+	game.tilesAcross = (width + tileSide - 1) >> tileShift;
+	game.widthInverse = ((uint64_t) 1 << 40) / width + 1;
+	uint32_t count = game.tilesAcross * ((height + tileSide - 1) >> tileShift);
+	game.terrain.assign(count, blankTile.terrain);
+	game.terrainOwner.reset();
+	game.ownTiles.assign(count, nullptr);
+	game.tilesUsed = 0;
+	game.tileBits.assign(count, nullptr);
+	game.bitsUsed = 0;
+	game.wallChanges = 0;
+	game.flow.from = flowNowhere;
+}
+
 
-		board[*pos] = '!';	// Update board.
+// The solid bits of tile index, built from its cells the first time they're asked for and kept
+// up to date by every write after that. Bits outside the room are clear.
+const uint64_t *tileBitsOf(Game &game, uint32_t index) {
+	uint64_t *bits = game.tileBits[index];
+	if (bits != nullptr) {
+		return bits;
+	}
+	if (game.bitsUsed == game.bitsPool.size()) {
+		game.bitsPool.emplace_back(new uint64_t[tileSide]);
+	}
+	bits = game.bitsPool[game.bitsUsed++].get();
+	memset(bits, 0, tileSide * sizeof(uint64_t));
+	uint16_t left = index % game.tilesAcross * tileSide;
+	uint16_t top = index / game.tilesAcross * tileSide;
+	uint16_t width = game.width - left < tileSide ? game.width - left : tileSide;
+	uint16_t height = game.height - top < tileSide ? game.height - top : tileSide;
+	for (uint16_t y = 0; y < height; y++) {
+		for (uint16_t x = 0; x < width; x++) {
+			bits[y] |= (uint64_t) (cellTraits.of[(uint8_t) cellAt(game, left + x, top + y)] & traitSolid) << x;
+		}
 	}
+	game.tileBits[index] = bits;
+	return bits;
 }
 
 
-// Causes the '!' at *pos to imitate the players actions.
-void copy(uint32_t *pos, uint16_t x) {
-	if (board[*pos] == '!') {
-		board[*pos] = ' ';
+// The 64 cells of row y from column x on as a word with a bit set for each solid one. Cells past
+// the right edge read as clear.
+uint64_t solidRow(Game &game, uint16_t x, uint16_t y) {
+	uint32_t index = (y >> tileShift) * game.tilesAcross + (x >> tileShift);
+	uint8_t shift = x & (tileSide - 1);
+	uint16_t row = y & (tileSide - 1);
+	uint64_t word = tileBitsOf(game, index)[row] >> shift;
+	if (shift != 0 && (x >> tileShift) + 1 < game.tilesAcross) {
+		word |= tileBitsOf(game, index + 1)[row] << (tileSide - shift);
+	}
+	return word;
+}
 
-		// Figure out where to move to.
-		uint16_t newPosition = (uint16_t) *pos;
-		switch (input) {
-			case 'w':
-				newPosition -= width;
-				break;
-			case 'a':
-				newPosition--;
-				break;
-			case 's':
-				newPosition += width;
-				break;
-			case 'd':
-				newPosition++;
+
+// Fill the board with a width by height room stored row by row in cells.
+void loadCells(Game &game, uint16_t width, uint16_t height, const char *cells) {
+	resizeBoard(game, width, height);
+	for (uint16_t y = 0; y < height; y++) {
+		const char *row = cells + (uint32_t) y * width;
+		for (uint16_t x = 0; x < width; x += tileSide) {
+			uint16_t length = width - x < tileSide ? width - x : tileSide;
+			uint32_t index = (y >> tileShift) * game.tilesAcross + (x >> tileShift);
+			char *tile = game.ownTiles[index];
+			if (tile == nullptr && memcmp(row + x, blankTile.cells, length) != 0) {
+				tile = ownTile(game, index);
+			}
+			if (tile != nullptr) {
+				memcpy(tile + ((y & (tileSide - 1)) << tileShift), row + x, length);
+			}
 		}
-		moveKnight((uint16_t) *pos, &newPosition);
+	}
+}
 
-		// Check if new position is clear.
-		if (board[newPosition] == ' ' || board[newPosition] == 'X' || board[newPosition] == '!') {
-			*pos = newPosition;
+
+// Split the board into packed terrain tiles and the pieces on top of them, the way rooms are stored.
+void packBoard(const Game &game, std::vector<uint8_t> &terrain, std::vector<Piece> &pieces) {
+	terrain.assign(game.terrain.size() * terrainBytes, 0);
+	pieces.clear();
+	for (uint16_t y = 0; y < game.height; y++) {
+		for (uint16_t x = 0; x < game.width; x++) {
+			char c = cellAt(game, x, y);
+			uint8_t code = terrainCodes.codes[(uint8_t) c];
+			if (code == noTerrain) {
+				Piece piece = {};
+				piece.position = (uint32_t) y * game.width + x;
+				piece.glyph = c;
+				pieces.push_back(piece);
+				code = 0;
+			}
+			uint32_t index = (y >> tileShift) * game.tilesAcross + (x >> tileShift);
+			setTerrain(terrain.data() + index * terrainBytes, ((y & (tileSide - 1)) << tileShift) + (x & (tileSide - 1)), code);
 		}
+	}
+}
 
-		board[*pos] = '!';	// Update board.
+
+// Put count pieces on the board without recording the change.
+void placePieces(Game &game, const Piece *pieces, uint32_t count) {
+	for (uint32_t i = 0; i < count; i++) {
+		setCell(game, pieces[i].position, pieces[i].glyph);
 	}
 }
 
 
-// Make an '!' waddle back and forth between two positions.
-// Used in hall.
-void danger(uint32_t *pos, uint16_t x) {
-	clear((uint16_t) *pos, '!');
-	if(*pos == 81) {
-		*pos = 82;
+// Record that the cells first through last, which must be in the same row, changed.
+// Only the part of the room in view is tracked.
+void touch(Game &game, uint32_t first, uint32_t last) {
+	uint16_t y = rowOf(game, first);
+	if (y < game.viewTop || y - game.viewTop >= game.viewHeight) {
+		return;
+	}
+	uint32_t left = (uint32_t) y * game.width + game.viewLeft;
+	if (last < left || first >= left + game.viewWidth) {
+		return;
+	}
+	uint8_t row = y - game.viewTop;
+	uint8_t start = first > left ? first - left : 0;
+	uint8_t end = last - left < game.viewWidth ? last - left : game.viewWidth - 1;
+	uint64_t bit = (uint64_t) 1 << row;
+	if ((game.dirtyRows & bit) == 0) {
+		game.dirtyRows |= bit;
+		game.dirtyFirst[row] = start;
+		game.dirtyLast[row] = end;
 	}
 	else {
-		*pos = 81;
+		if (start < game.dirtyFirst[row]) {
+			game.dirtyFirst[row] = start;
+		}
+		if (end > game.dirtyLast[row]) {
+			game.dirtyLast[row] = end;
+		}
 	}
-	board[*pos] = '!';
 }
 
 
-// Makes the '?' blink in and out of existence. If '?' is hit, door appears and flag set.
-// Used in prison.
-void button(uint32_t *signal, uint16_t x) {
+// Record that the whole room changed.
+void touchAll(Game &game) {
+	uint8_t rows = game.height < game.viewHeight ? game.height : game.viewHeight;
+	game.dirtyRows = rows == 64 ? ~(uint64_t) 0 : ((uint64_t) 1 << rows) - 1;
+	memset(game.dirtyFirst, 0, rows);
+	memset(game.dirtyLast, (game.width < game.viewWidth ? game.width : game.viewWidth) - 1, rows);
+}
+
+
+// Forget all recorded changes once they have been dealt with.
+void markClean(Game &game) {
+	game.dirtyRows = 0;
+}
+
 
-	// If ? is hit.
-	if ((*signal & 0x80000000) == 0x80000000) {
-		board[14] = 'd';	// Make door.
-		flags |= 1;			// Signal for room to change.
+// Set one cell of the board. All writes to the board go through here or the line helpers.
+void put(Game &game, uint32_t pos, char c) {
+	if (pos < (uint32_t) game.width * game.height && cell(game, pos) != c) {
+		setCell(game, pos, c);
+		touch(game, pos, pos);
 	}
+}
+
 
-	// Blink in and out of existence.
-	if (board[6] == ' ') {
-		board[6] = '?';
+// Set count cells stride apart from pos on to c and record the change: a column when stride
+// is the room's width, a diagonal when it's one more or less. The position is stepped along
+// without dividing, and each tile is only looked up again when the line leaves it.
+void strideCells(Game &game, uint32_t pos, uint32_t count, uint32_t stride, char c) {
+	if (count == 0 || pos >= (uint32_t) game.width * game.height) {
+		return;
 	}
-	else {
-		board[6] = ' ';
+	uint16_t y = rowOf(game, pos);
+	uint16_t x = pos - (uint32_t) y * game.width;
+	uint16_t down = stride / game.width;
+	uint16_t across = stride - (uint32_t) down * game.width;
+	while (true) {
+		uint32_t index = (y >> tileShift) * game.tilesAcross + (x >> tileShift);
+		uint32_t offset = ((y & (tileSide - 1)) << tileShift) + (x & (tileSide - 1));
+		char *tile = game.ownTiles[index];
+		if (tile == nullptr && terrainAt(game.terrain[index], offset) != c) {
+			tile = ownTile(game, index);
+		}
+		if (tile != nullptr && tile[offset] != c) {
+			tile[offset] = c;
+			markBits(game, index, y & (tileSide - 1), (uint64_t) 1 << (x & (tileSide - 1)), c);
+			touch(game, pos, pos);
+		}
+		if (--count == 0) {
+			return;
+		}
+		pos += stride;
+		y += down;
+		x += across;
+		if (x >= game.width) {
+			x -= game.width;
+			y++;
+		}
+		if (y >= game.height) {
+			return;
+		}
 	}
 }
 
 
-// Makes the door appear when the ? in blocks is hit.
-void reveal(uint32_t *signal, uint16_t x) {
-	if ((*signal >> 31) == 1) {
-		board[3] = 'w';
-		board[87] = 's';
-	}
+// Forget what is on the screen so the next frame redraws all of it.
+// Needed after a room change and after anything else has been printed.
+void redraw(Screen &screen) {
+	screen.shownHeight = 0;
+}
+
+
+// Show views of at most width by height on screen from the next frame on.
+void fitScreen(Screen &screen, uint8_t width, uint8_t height) {
+	screen.fitWidth = width;
+	screen.fitHeight = height;
+	screen.shown.resize(width * height);
+	redraw(screen);
 }
 
 
-// Makes a giant wall of !'s spawn at the bottom and gradually move up.
-void destroy(uint32_t *pos, uint16_t x) {
-	if (*pos != 0) {
-		*pos -= 80;		// Move up.
+// Append the escape sequence that moves the cursor to the given room cell.
+char *moveCursor(char *out, uint8_t row, uint8_t column) {
+	*(out++) = '\033';
+	*(out++) = '[';
+	out += sprintf(out, "%u", row + 1);
+	*(out++) = ';';
+	out += sprintf(out, "%u", column + 1);
+	*(out++) = 'H';
+	return out;
+}
 
-		// If still inside the outer wall, replace the next layer of stuff with !'s.
-		if ((int) *pos > 80) {
-			for (uint16_t i = *pos; i < *pos + 78; i++) {
-				board[i] = '!';
-			}
-		}
 
-		// If wall o death has progressed a bit, let the back of the wall o death fade.
-		if ((int) *pos > -160 && (int) *pos < 2870) {
-			for (uint16_t i = *pos + 240; i < *pos + 318; i++) {
-				board[i] = ' ';
-			}
+// Append the cells touched since the last frame that differ from what is on the screen.
+// Returns nullptr if that would take more bytes than redrawing the whole room.
+char *printChanges(Game &game, Screen &screen, char *out, char player) {
+	uint8_t height = screen.shownHeight;
+	uint8_t width = screen.shownWidth;
+	const char *limit = out + height * (width + 1);
+	uint8_t row = height;	// The cursor is left below the room after every frame.
+	uint8_t column = 0;
+	for (uint8_t i = 0; i < height; i++) {
+		if ((game.dirtyRows & ((uint64_t) 1 << i)) == 0) {
+			continue;
 		}
+		char *old = screen.shown.data() + width * i;
+		for (uint8_t j = game.dirtyFirst[i]; j <= game.dirtyLast[i]; j++) {
+			char c = cellAt(game, game.viewLeft + j, game.viewTop + i);
+			if (c == 'X') {
+				c = player;
+			}
+			if (c == old[j]) {
+				continue;
+			}
 
-		// If the wall o death has left the room, stop messing with it.
-		else if ((int) *pos < -200) {
-			*pos = 0;
+			// Rewriting a few unchanged cells is cheaper than a cursor move.
+			if (row == i && j >= column && j - column < 4) {
+				memcpy(out, old + column, j - column);
+				out += j - column;
+			}
+			else {
+				out = moveCursor(out, i, j);
+			}
+			*(out++) = c;
+			old[j] = c;
+			row = i;
+			column = j + 1;
+			if (out >= limit) {
+				return nullptr;
+			}
 		}
 	}
+	if (row != height) {
+		out = moveCursor(out, height, 0);
+	}
+	return out;
 }
 
 
-// Makes a wall of !'s travel horizontally.
-void killHor(uint32_t *pos, uint16_t x) {
-	uint16_t p = (uint16_t) *pos;
-	for (uint16_t i = 0; i < 750; i += 80) {
-		board[1681 + p + i] = ' ';
+// Where along one axis of the room a view of size cells should start so it shows the player at
+// player. It stays where it was at origin until the player gets within a quarter of the view of
+// an edge, then jumps to put the player in the middle, so most moves don't scroll the screen.
+uint16_t follow(uint16_t origin, uint16_t player, uint8_t size, uint16_t room) {
+	uint8_t margin = size / 4;
+	if (player < origin + margin || player >= origin + size - margin) {
+		origin = player > size / 2 ? player - size / 2 : 0;
 	}
-	*pos -= p;
-	if ((*pos & 0x80000000) == 0x80000000) {
-		p++;
+	return origin + size > room ? room - size : origin;
+}
+
+
+// Point the camera of game at the player, with a view of as much of the room as fits in width by height.
+void aimCamera(Game &game, uint8_t width, uint8_t height) {
+	game.viewWidth = game.width < width ? game.width : width;
+	game.viewHeight = game.height < height ? game.height : height;
+	uint16_t y = rowOf(game, game.position);
+	game.viewLeft = follow(game.viewLeft, game.position - (uint32_t) y * game.width, game.viewWidth, game.width);
+	game.viewTop = follow(game.viewTop, y, game.viewHeight, game.height);
+}
+
+
+// Compose the next frame of game for screen into out, which must hold frameSize bytes.
+// Returns the end of the frame. Only the view around the player is drawn.
+char *compose(Game &game, Screen &screen, char *out) {
+	char player = (game.flags & 0x20) == 0x20 ? 'Y' : 'X';	// Show the player as 'Y' while the sticky is in use.
+	aimCamera(game, screen.fitWidth, screen.fitHeight);
+	uint8_t height = game.viewHeight;
+	uint8_t width = game.viewWidth;
+	char *end = nullptr;
+	if (screen.shownHeight == height && screen.shownWidth == width && screen.shownLeft == game.viewLeft && screen.shownTop == game.viewTop) {
+		if (player != screen.shownPlayer) {
+			touchAll(game);		// The player's cell isn't known here, so look at all of them.
+		}
+		end = printChanges(game, screen, out, player);
 	}
-	else {
-		p += 77;
+
+	// Redraw everything after a room change, when the camera moved, or when most of the view changed.
+	if (end == nullptr) {
+		end = out;
+		memcpy(end, "\033[H\033[J", 6);	// Move home and clear the screen.
+		end += 6;
+		for (uint8_t i = 0; i < height; i++) {
+			char *old = screen.shown.data() + width * i;
+			for (uint8_t j = 0; j < width; j++) {
+				old[j] = cellAt(game, game.viewLeft + j, game.viewTop + i);
+				if (old[j] == 'X') {
+					old[j] = player;
+				}
+			}
+			memcpy(end, old, width);
+			end += width;
+			if (screen.crlf) {
+				*(end++) = '\r';
+			}
+			*(end++) = '\n';
+		}
+		screen.shownHeight = height;
+		screen.shownWidth = width;
+		screen.shownLeft = game.viewLeft;
+		screen.shownTop = game.viewTop;
 	}
-	p %= 78;
-	*pos += p;
-	for (uint16_t i = 0; i < 750; i += 80) {
-		board[1681 + p + i] = '!';
+	screen.shownPlayer = player;
+	markClean(game);
+	return end;
+}
+
+
+// Send the current room to the screen right away.
+void render(Game &game) {
+	char *out = compose(game, terminal, frame);
+	framePending = false;
+	fflush(stdout);		// Anything printf'd earlier has to reach the screen before this frame.
+	flush(frame, out - frame);
+	if (keysArrived != 0) {
+		uint64_t latency = now() - keysArrived;
+		latencyFrames++;
+		latencyTotal += latency;
+		if (latency > latencyMax) {
+			latencyMax = latency;
+		}
+		keysArrived = 0;
 	}
 }
 
 
-// Makes a wall of !'s travel vertically.
-void killVert(uint32_t *pos, uint16_t x) {
-	uint16_t p = (uint16_t) *pos;
-	for (uint16_t i = 0; i < 78; i++) {
-		board[1681 + (80 * p) + i] = ' ';
+// Move whatever input the terminal has into the key ring, waiting up to timeout
+// milliseconds (-1 means forever) for some to show up.
+void readKeys(int timeout) {
+	uint32_t pending = keysWritten - keysRead;
+	if (pending == sizeof(keys) || inputClosed) {
+		return;
 	}
-	*pos -= p;
-	if ((*pos & 0x80000000) == 0x80000000) {
-		p++;
+	pollfd in = {STDIN_FILENO, POLLIN, 0};
+	int ready;
+	do {
+		ready = poll(&in, 1, timeout);
+	} while (ready < 0 && errno == EINTR);
+	if (ready != 1) {
+		return;
 	}
-	else {
-		p += 9;
+
+	// Read straight into the free part of the ring that doesn't wrap around.
+	uint32_t start = keysWritten % sizeof(keys);
+	uint32_t space = sizeof(keys) - pending;
+	if (space > sizeof(keys) - start) {
+		space = sizeof(keys) - start;
+	}
+	ssize_t length;
+	do {
+		length = read(STDIN_FILENO, keys + start, space);
+	} while (length < 0 && errno == EINTR);
+	if (length <= 0) {
+		inputClosed = true;
+		return;
 	}
-	p %= 10;
-	*pos += p;
-	for (uint16_t i = 0; i < 78; i++) {
-		board[1681 + (80 * p) + i] = '!';
+	if (keysArrived == 0) {
+		keysArrived = now();
 	}
+	keysWritten += length;
 }
 
 
-// Blocks the door the player entered from and creates a new one that's obnoxious to get to.
-// Used in knightsMove.
-void knight(uint32_t *signal, uint16_t x) {
-	if ((*signal >> 31) == 1) {
-		board[1970] = '-';
-		board[1850] = 'a';
-	}
+// Check, without waiting, whether the player has typed keys that haven't been acted on yet.
+bool keysPending() {
+	readKeys(0);
+	return keysWritten != keysRead;
 }
 
-// Spawns a line of B's that overlaps with one of the walls.
-// Used in final room.
-void change(uint32_t *signal, uint16_t x) {
-	if ((*signal >> 31) == 1) {
-		vertical(123, 5, 'B');
-		*signal = 0;
+
+// Turn the final byte of an escape sequence into a key: arrows become wasd, anything else a no-op.
+char arrowKey(char c) {
+	switch (c) {
+		case 'A':
+			return 'w';
+		case 'B':
+			return 's';
+		case 'C':
+			return 'd';
+		case 'D':
+			return 'a';
+		default:
+			return '\033';
 	}
 }
 
 
-// A room with an enemy that chases you and a bunch of pointless m's that disapear when you step on them.
-uint16_t mudRoom(char c, void (** action)(uint32_t*, uint16_t), uint32_t *data) {
-	width = 10;
-	height = 10;
-	horizontalWall(0, 10);
-	uint8_t i;
-	for (i = 1; i < 9; i++) {
-		board[i * 10] = '-';
-		for (uint8_t j = 1; j < 9; j++) {
-			board[10 * i + j] = 'm';
+// Get the next key the player typed, waiting for one if there aren't any.
+// Arrow keys come back as the matching wasd key. Closed input reads as 't' so the game ends.
+char readKey() {
+	if (keysWritten == keysRead) {
+		readKeys(-1);
+		if (keysWritten == keysRead) {
+			return 't';
 		}
-		board[10 * (i + 1) - 1] = '-';
-	}
-	horizontalWall(90, 10);
-	board[5] = 'w';
-	board[95] = 's';
-	board[45] = '!';
-	action[0] = chase;
-	data[0] = 45;
-	action[1] = nullptr;
-	if (c == 'w') {
-		return 85;
 	}
-	else {
-		return 15;
+	char c = keys[keysRead++ % sizeof(keys)];
+	if (c != '\033') {
+		return c;
 	}
-}
 
-uint16_t blocks(char c, void (** action)(uint32_t*, uint16_t), uint32_t *data) {
-	width = 7;
-	height = 13;
-	edgeWalls();
-	horizontal(29, 2, 'B');
-	horizontal(32, 2, 'B');
-	horizontal(57, 2, 'B');
-	horizontal(60, 2, 'B');
-	horizontal(43, 2, '-');
-	horizontal(46, 2, '-');
-	board[9] = 'B';
-	board[11] = 'B';
-	board[17] = 'B';
-	board[38] = 'B';
-	board[52] = 'B';
-	board[73] = 'B';
-	board[79] = 'B';
-	board[81] = 'B';
-	board[45] = '?';
-	// board[35] = 'a';
-	action[0] = reveal;
-	data[0] = 0;
-	action[1] = nullptr;
-	if (c == 'w') {
-		board[87] = 's';
-		return 80;
+	// An escape sequence may be split across reads, so give the rest of it a moment to arrive.
+	if (keysWritten - keysRead < 2) {
+		readKeys(50);
 	}
-	else {
-		board[3] = 'w';
-		return 10;
+	if (keysWritten - keysRead < 2 || (keys[keysRead % sizeof(keys)] != '[' && keys[keysRead % sizeof(keys)] != 'O')) {
+		return c;
 	}
+	keysRead++;
+	do {
+		if (keysWritten == keysRead) {
+			readKeys(50);
+			if (keysWritten == keysRead) {
+				return c;
+			}
+		}
+		c = keys[keysRead++ % sizeof(keys)];
+	} while (c < 0x40 || c > 0x7E);		// Skip parameters up to the final byte.
+	return arrowKey(c);
 }
 
-uint16_t hall(char c, void (**action)(uint32_t*, uint16_t), uint32_t *data) {
-	width = 5;
-	height = 40;
-	edgeWalls();
-	board[2] = 'w';
-	board[197] = 's';
-	board[81] = '!';
-	action[0] = danger;
-	data[0] = 82;
-	action[1] = nullptr;
-	if (c == 'w') {
-		return 192;
-	}
-	else {
-		return 7;
-	}
-}
 
-uint16_t tele(char c, void (**action)(uint32_t*, uint16_t), uint32_t *data) {
-	width = 7;
-	height = 11;
-	edgeWalls();
-	horizontal(36, 5, '-');
-	board[24] = '*';
-	board[52] = '*';
-	board[3] = 'w';
-	board[73] = 's';
-	action[0] = nullptr;
-	data[1] = 24;
-	data[2] = 52;
-	if (c == 'w') {
-		return 66;
+// Print the current room to the screen.
+// If the terminal is still busy with earlier output the frame is held back, and the changes
+// pile up on the board so that only the newest frame is written once there is room for it.
+void print(Game &game) {
+	pollfd out = {STDOUT_FILENO, POLLOUT, 0};
+	if (poll(&out, 1, 0) == 1) {
+		render(game);
 	}
 	else {
-		return 10;
+		framePending = true;
 	}
 }
 
-uint16_t prison(char c, void (**action)(uint32_t*, uint16_t), uint32_t *data) {
-	width = 5;
-	height = 5;
-	edgeWalls();
-	action[0] = button;
-	data[0] = 0;
-	action[1] = nullptr;
-	return 12;
-}
 
-uint16_t secret(char c, void (**action)(uint32_t*, uint16_t), uint32_t *data) {
-	width = 7;
-	height = 10;
-	edgeWalls();
-	action[0] = nullptr;
-	board[16] = '-';
-	board[18] = '-';
-	board[37] = '-';
-	board[39] = '-';
-	board[51] = '-';
-	board[53] = '-';
-	board[3] = 'w';
-	board[66] = 's';
-	switch (c) {
-		case 'w':
-			return 59;
-		case 's':
-			return 10;
-		default:
-			return 31;
+// Fit the view to the terminal, leaving room below it for messages.
+// When stdout isn't a terminal the view is the default size.
+void measureTerminal() {
+	winsize size;
+	uint8_t width = defaultViewWidth;
+	uint8_t height = defaultViewHeight;
+	if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) == 0 && size.ws_col > 0 && size.ws_row > messageRows) {
+		width = size.ws_col < maxViewWidth ? size.ws_col : maxViewWidth;
+		height = size.ws_row - messageRows < maxViewHeight ? size.ws_row - messageRows : maxViewHeight;
 	}
+	fitScreen(terminal, width, height);
 }
 
-uint16_t bigRoom(char c, void (**action)(uint32_t*, uint16_t), uint32_t *data) {
-	width = 80;
-	height = 40;
-	edgeWalls();
-	board[40] = 'w';
-	board[1600] = 'a';
-	board[3160] = 's';
-	board[1679] = 'd';
-	action[0] = nullptr;
-	switch(c) {
-		case 'w':
-			return 3080;
-		case 'a':
-			return 1678;
-		case 's':
-			return 120;
-		default:
-			return 1601;
-	}
+
+// Note that the terminal was resized. The view is fitted to it again before the next key is read.
+void onResize(int) {
+	resized = 1;
 }
 
-uint16_t labyrinth(char c, void (**action)(uint32_t*, uint16_t), uint32_t *data) {
-	width = 80;
-	height = 30;
-	edgeWalls();
-	horizontalWall(402, 59);
-	horizontalWall(724, 57);
-	horizontalWall(883, 57);
-	horizontalWall(1021, 17);
-	horizontalWall(1121, 60);
-	horizontalWall(1183, 16);
-	horizontalWall(1246, 14);
-	horizontalWall(1284, 21);
-	horizontalWall(1309, 7);
-	horizontalWall(1400, 38);
-	horizontalWall(1444, 20);
-	horizontalWall(1556, 43);
-	horizontalWall(1714, 44);
-	horizontalWall(1764, 15);
-	horizontalWall(1872, 47);
-	horizontalWall(1923, 8);
-	horizontalWall(1932, 9);
-	horizontalWall(2030, 48);
-	horizontalWall(2085, 16);
-	horizontalWall(2188, 51);
-	verticalWall(91, 3);
-	verticalWall(111, 3);
-	verticalWall(118, 3);
-	verticalWall(131, 3);
-	verticalWall(141, 11);
-	verticalWall(164, 3);
-	verticalWall(179, 3);
-	verticalWall(193, 3);
-	verticalWall(205, 3);
-	verticalWall(218, 3);
-	verticalWall(482, 8);
-	verticalWall(1202, 13);
-	verticalWall(1202, 2);
-	verticalWall(1305, 13);
-	verticalWall(1307, 10);
-	verticalWall(1526, 2);
-	verticalWall(1530, 2);
-	verticalWall(1534, 2);
-	verticalWall(1538, 2);
-	verticalWall(1541, 8);
-	verticalWall(1608, 2);
-	verticalWall(1612, 2);
-	verticalWall(1616, 2);
-	verticalWall(1624, 9);
-	verticalWall(1629, 3); 
-	leftDiag(1239, 13, '-');
-	leftDiagWall(1262, 2);
-	rightDiagWall(1389, 4);
-	board[150] = '-';
-	board[235] = '-';
-	board[304] = '-';
-	board[470] = '-';
-	board[544] = '-';
-	board[634] = '-';
-	board[709] = '-';
-	board[793] = '-';
-	board[866] = '-';
-	board[1100] = '-';
-	board[1325] = '-';
-	board[1473] = '-';
-	board[1488] = '-';
-	board[1498] = '-';
-	board[1523] = '-';
-	board[1660] = '-';
-	board[1818] = '-';
-	board[1979] = '-';
-	board[301] = ' ';
-	board[701] = ' ';
-	board[1409] = ' ';
-	board[1422] = ' ';
-	board[1561] = ' ';
-	board[1575] = ' ';
-	board[1589] = ' ';
-	board[1739] = ' ';
-	board[1874] = ' ';
-	board[1888] = ' ';
-	board[1913] = ' ';
-	board[2044] = ' ';
-	board[2223] = ' ';
-	board[1271] = 'w';
-	board[1200] = 'a';
-	board[1043] = 's';
-	board[1041] = 'd';
-	action[0] = nullptr;
-	switch(c) {
-		case 'w':
-			return 963;
-		case 'a':
-			return 961;
-		case 's':
-			return 1351;
-		default:
-			return 1201;
+
+// Wait until there's input to read. A held back frame is sent as soon as the terminal
+// drains, unless more input shows up first and makes it out of date. If the terminal is
+// resized meanwhile, the room is drawn again to fit.
+void awaitInput(Game &game) {
+	while (keysWritten == keysRead && !inputClosed) {
+		if (resized) {
+			resized = 0;
+			measureTerminal();
+			print(game);
+		}
+		pollfd fds[2] = {{STDIN_FILENO, POLLIN, 0}, {STDOUT_FILENO, POLLOUT, 0}};
+		if (poll(fds, framePending ? 2 : 1, -1) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			if (framePending) {
+				render(game);
+			}
+			return;
+		}
+		else if (fds[1].revents != 0) {
+			render(game);
+		}
+		else if (fds[0].revents != 0) {
+			return;
+		}
 	}
 }
 
-uint16_t blockRoom(char c, void (**action)(uint32_t*, uint16_t), uint32_t *data) {
-	width = 11;
-	height = 10;
-	edgeWalls();
-	horizontal(27, 4, '-');
-	horizontal(49, 2, '-');
-	horizontal(96, 2, 'B');
-	vertical(14, 4, '-');
-	vertical(41, 2, '-');
-	vertical(74, 2, '-');
-	vertical(58, 4, 'B');
-	vertical(68, 3, 'B');
-	board[62] = 'B';
-	board[70] = 'B';
-	board[64] = '!';
-	board[1] = 'w';
-	board[65] = 'd';
-	action[0] = nullptr;
-	return 12;
+
+// Switch to the terminal's alternate screen so frames don't scroll or fill the scrollback.
+void enterScreen() {
+	fflush(stdout);
+	flush("\033[?1049h\033[?25l", 14);
+	onAltScreen = true;
+	redraw(terminal);
 }
 
-uint16_t frontRoom(char c, void (**action)(uint32_t*, uint16_t), uint32_t *data) {
-	width = 10;
-	height = 10;
-	edgeWalls();
-	board[5] = 'w';
-	board[95] = 's';
-	action[0] = nullptr;
-	if (c == 's') {
-		return 15;
+
+// Put the terminal back the way we found it. Safe to call from a signal handler.
+void restoreTerminal() {
+	if (onAltScreen) {
+		onAltScreen = false;
+		flush("\033[?25h\033[?1049l", 14);
+	}
+	if (terminalChanged) {
+		terminalChanged = false;
+		tcsetattr(STDIN_FILENO, TCSANOW, &savedTerminal);
 	}
-	board[45] = 'X';
-	return 45;
 }
 
-uint16_t knightsMove(char c, void (**action)(uint32_t*, uint16_t), uint32_t *data) {
-	width = 50;
-	height = 40;
-	edgeWalls();
-	horizontal(1853, 34, '-');
-	for(uint16_t i = 52; i < 88; i++) {
-		vertical(i, 37, '-');
-	}
-	horizontal(904, 14, ' ');
-	vertical(89, 2, '-');
-	board[82] = ' ';
-	board[123] = ' ';
-	board[130] = ' ';
-	board[136] = ' ';
-	board[171] = ' ';
-	board[178] = ' ';
-	board[183] = ' ';
-	board[219] = ' ';
-	board[222] = ' ';
-	board[226] = ' ';
-	board[235] = ' ';
-	board[267] = ' ';
-	board[274] = ' ';
-	board[315] = ' ';
-	board[320] = ' ';
-	board[334] = ' ';
-	board[363] = ' ';
-	board[367] = ' ';
-	board[372] = ' ';
-	board[382] = ' ';
-	board[411] = ' ';
-	board[420] = ' ';
-	board[434] = ' ';
-	board[459] = ' ';
-	board[481] = ' ';
-	board[486] = ' ';
-	board[507] = ' ';
-	board[519] = ' ';
-	board[534] = ' ';
-	board[555] = ' ';
-	board[582] = ' ';
-	board[618] = ' ';
-	board[654] = ' ';
-	board[719] = ' ';
-	board[820] = ' ';
-	board[869] = ' ';
-	board[873] = ' ';
-	board[921] = ' ';
-	board[925] = ' ';
-	board[1024] = ' ';
-	board[1072] = ' ';
-	board[1120] = ' ';
-	board[1168] = ' ';
-	board[1165] = ' ';
-	board[1216] = ' ';
-	board[1264] = ' ';
-	board[1312] = ' ';
-	board[1360] = ' ';
-	board[1408] = ' ';
-	board[1456] = ' ';	
-	board[1504] = ' ';
-	board[1603] = ' ';
-	board[1903] = '-';
-	board[88] = '+';
-	board[138] = '?';
-	board[1970] = 's';
-	action[0] = knight;
-	data[0] = 0;
-	action[1] = nullptr;
-	return 1920;
-}
 
-uint16_t powerGrip(char c, void (**action)(uint32_t*, uint16_t), uint32_t *data) {
-	width = 15;
-	height = 15;
-	edgeWalls();
-	horizontal(69, 4, '-');
-	horizontal(115, 4, '-');
-	horizontal(159, 4, '-');
-	vertical(22, 9, '-');
-	vertical(24, 3, '-');
-	horizontal(46, 5, 'B');
-	horizontal(61, 5, 'B');
-	horizontal(99, 2, 'B');
-	horizontal(130, 4, 'B');
-	vertical(21, 8, 'B');
-	board[143] = '-';
-	board[84] = 'B';
-	board[86] = 'B';
-	board[128] = 'B';
-	board[42] = '+';
-	board[15] = 'a';
-	action[0] = nullptr;
-	return 202;
+// Go back to the normal screen and show the room there one last time.
+void leaveScreen(Game &game) {
+	restoreTerminal();
+	redraw(terminal);
+	render(game);
 }
 
-uint16_t finalRoom(char c, void (**action)(uint32_t*, uint16_t), uint32_t *data) {
-	width = 80;
-	height = 40;
-	edgeWalls();
-	horizontal(401, 78, '-');
-	horizontal(481, 78, '-');
-	horizontal(965, 74, '-');
-	horizontal(1045, 74, '-');
-	horizontal(1521, 77, '-');
-	horizontal(1601, 78, '-');
-	horizontal(2482, 77, '-');
-	horizontal(2561, 78, '-');
-	horizontal(1841, 78, 'B');
-	horizontal(1921, 78, 'B');
-	vertical(122, 5, '-');
-	rightDiag(2840, 4, 'B');
-	rightDiag(2920, 3, '-');
-	rightDiag(3000, 2, '!');
-	leftDiag(2919, 3, 'B');
-	leftDiag(2999, 2, '-');
-	board[3079] = '!';
-	board[696] = 'B';
-	board[1598] = 'B';
-	board[2481] = 'B';
-	board[754] = '!';
-	board[781] = '!';
-	board[1242] = '!';
-	board[1295] = '!';
-	board[321] = '?';
-	board[40] = 'w';
-	action[0] = change;
-	data[0] = 0;
-	action[1] = chase;
-	data[1] = 1242;
-	action[2] = chase;
-	data[2] = 754;
-	action[3] = copy;
-	data[3] = 781;
-	action[4] = copy;
-	data[4] = 1295;
-	action[5] = killHor;
-	data[5] = 0x80000000;
-	action[6] = killHor;
-	data[6] = 77;
-	action[7] = killVert;
-	data[7] = 0x80000000;
-	action[8] = killVert;
-	data[8] = 9;
-	action[9] = nullptr;
-	board[3080] = 'o';
-	return 120;
+
+// Clean up the terminal before dying from a signal.
+void onSignal(int signal) {
+	restoreTerminal();
+	::signal(signal, SIG_DFL);
+	raise(signal);
 }
 
-uint16_t room(char c, void (**action)(uint32_t*, uint16_t), uint32_t *data) {
-	width = 15;
-	height = 15;
-	edgeWalls();
-	board[7] = 'w';
-	board[105] = 'a';
-	board[217] = 's';
-	board[119] = 'd';
-	action[0] = nullptr;
-	switch(c) {
-		case 'w':
-		case 'W':
-			return 202;
-		case 'a':
-		case 'A':
-			return 118;
-		case 's':
-		case 'S':
-			return 22;
-		default:
-			return 106;
+
+// Give the terminal back while stopped by ^Z, and take it again once continued. The view is
+// drawn again in full before the next key is read, since the shell will have written over it.
+void onStop(int) {
+	bool altScreen = onAltScreen;
+	bool changed = terminalChanged;
+	restoreTerminal();
+	signal(SIGTSTP, SIG_DFL);
+	sigset_t stop;
+	sigemptyset(&stop);
+	sigaddset(&stop, SIGTSTP);
+	sigprocmask(SIG_UNBLOCK, &stop, nullptr);
+	raise(SIGTSTP);		// Stopped here until continued.
+	signal(SIGTSTP, onStop);
+	if (changed) {
+		terminalChanged = true;
+		tcsetattr(STDIN_FILENO, TCSANOW, &rawTerminal);
 	}
+	if (altScreen) {
+		flush("\033[?1049h\033[?25l", 14);
+		onAltScreen = true;
+	}
+	resized = 1;
 }
 
-uint16_t left(char c, void (**action)(uint32_t*, uint16_t), uint32_t *data) {
-	uint16_t pos = room(c, action, data);
-	board[105] = '-';
-	return pos;
-}
 
-uint16_t right(char c, void (**action)(uint32_t*, uint16_t), uint32_t *data) {
-	uint16_t pos = room(c, action, data);
-	board[119] = '-';
-	return pos;
+// Change terminal settings to get keys as soon as they are typed, without echo.
+// A read returns as soon as one key is there and takes everything that has piled up.
+// The old settings come back on every way out of the game, including fatal signals, and while
+// it's stopped with ^Z.
+void rawMode() {
+	if (tcgetattr(STDIN_FILENO, &savedTerminal) != 0) {
+		return;
+	}
+	rawTerminal = savedTerminal;
+	rawTerminal.c_lflag &= ~(ICANON | ECHO | IEXTEN);
+	rawTerminal.c_iflag &= ~(IXON | ICRNL);
+	rawTerminal.c_cc[VMIN] = 1;
+	rawTerminal.c_cc[VTIME] = 0;
+	terminalChanged = true;
+	atexit(restoreTerminal);
+	signal(SIGINT, onSignal);
+	signal(SIGTERM, onSignal);
+	signal(SIGHUP, onSignal);
+	signal(SIGQUIT, onSignal);
+	signal(SIGTSTP, onStop);
+	tcsetattr(STDIN_FILENO, TCSANOW, &rawTerminal);
 }
 
-uint16_t top(char c, void (**action)(uint32_t*, uint16_t), uint32_t *data) {
-	uint16_t pos = room(c, action, data);
-	board[7] = '-';
-	return pos;
-}
 
-uint16_t bottom(char c, void (**action)(uint32_t*, uint16_t), uint32_t *data) {
-	uint16_t pos = room(c, action, data);
-	board[217] = '-';
-	return pos;
-}
+// Make a horizontal line of c.
+void horizontal(Game &game, uint32_t start, uint32_t length, char c) {
+	if (length == 0) {
+		return;
+	}
+	fillCells(game, start, length, c);
 
-uint16_t topLeft(char c, void (**action)(uint32_t*, uint16_t), uint32_t *data) {
-	uint16_t pos = top(c, action, data);
-	board[105] = '-';
-	return pos;
+	// A line may wrap onto the next rows, so record each row it touches.
+	uint32_t end = start + length - 1;
+	uint32_t rowEnd = ((uint32_t) rowOf(game, start) + 1) * game.width - 1;
+	while (rowEnd < end) {
+		touch(game, start, rowEnd);
+		start = rowEnd + 1;
+		rowEnd += game.width;
+	}
+	touch(game, start, end);
 }
 
-uint16_t topRight(char c, void (**action)(uint32_t*, uint16_t), uint32_t *data) {
-	uint16_t pos = top(c, action, data);
-	board[119] = '-';
-	return pos;
+
+// Make a vertical line of c.
+void vertical(Game &game, uint32_t start, uint32_t length, char c) {
+	strideCells(game, start, length, game.width, c);
 }
 
-uint16_t bottomLeft(char c, void (**action)(uint32_t*, uint16_t), uint32_t *data) {
-	uint16_t pos = bottom(c, action, data);
-	board[105] = '-';
-	return pos;
+
+// Sets *newPosition to be a knight's move away from position.
+void moveKnight(Game &game, uint32_t position, uint32_t *newPosition) {
+	switch(game.input) {
+		case 'y':
+			if (position % game.width > 1) {
+				*newPosition -= (2 + game.width);
+			}
+			break;
+		case 'u':
+			if (position > 2 * game.width) {
+				*newPosition -= (1 + 2 * game.width);
+			}
+			break;
+		case 'i':
+			if (position > 2 * game.width) {
+				*newPosition += (1 - 2 * game.width);
+			}
+			break;
+		case 'o':
+			if (position % game.width + 2 < game.width) {
+				*newPosition += (2 - game.width);
+			}
+			break;
+		case 'h':
+			if (position % game.width > 1) {
+				*newPosition += (game.width - 2);
+			}
+			break;
+		case 'j':
+			if (position < (uint32_t) game.width * (game.height - 2)) {
+				*newPosition += (2 * game.width - 1);
+			}
+			break;
+		case 'k':
+			if (position < (uint32_t) game.width * (game.height - 2)) {
+				*newPosition += (2 * game.width + 1);
+			}
+			break;
+		case 'l':
+			if (position % game.width + 2 < game.width) {
+				*newPosition += (2 + game.width);
+			}
+	}
 }
 
-uint16_t bottomRight(char c, void (**action)(uint32_t*, uint16_t), uint32_t *data) {
-	uint16_t pos = bottom(c, action, data);
-	board[119] = '-';
-	return pos;
+
+// Clears the space something was at if it hasn't already been overwritten.
+void clear(Game &game, uint32_t pos, char old) {
+	if (cell(game, pos) == old) {
+		put(game, pos, ' ');
+	}
 }
 
-uint16_t cheese(char c, void (**action)(uint32_t*, uint16_t), uint32_t *data) {
-	uint16_t pos = room(c, action, data);
-	if ((flags & 0x10) == 0) {
-		board[112] = 'c';
+
+// Add an entity of kind to the room at the end of its kind's run.
+// Entities added after the room is entered are only scheduled by scheduleEntities.
+void addEntity(Game &game, uint8_t kind, uint32_t position, uint32_t state) {
+	Entities &entities = game.entities;
+	uint32_t at = entities.first[kind + 1];
+	entities.position.insert(entities.position.begin() + at, position);
+	entities.state.insert(entities.state.begin() + at, state);
+	for (uint8_t i = kind + 1; i <= kindCount; i++) {
+		entities.first[i]++;
 	}
-	return pos;
 }
 
-uint16_t down(char c, void (**action)(uint32_t*, uint16_t), uint32_t *data) {
-	uint16_t pos = topLeft(c, action, data);
-	board[119] = '-';
-	return pos;
+
+// The slot of the occupancy table cell pos is in, or the empty one it would go in.
+inline uint32_t occupancySlot(const Occupancy &occupancy, uint32_t pos) {
+	uint32_t mask = occupancy.cells.size() - 1;
+	uint32_t slot = (pos * 0x9E3779B1) >> occupancy.shift;
+	while (occupancy.cells[slot] != pos && occupancy.cells[slot] != noEntity) {
+		slot = (slot + 1) & mask;
+	}
+	return slot;
 }
 
-uint16_t up(char c, void (**action)(uint32_t*, uint16_t), uint32_t *data) {
-	uint16_t pos = bottomRight(c, action, data);
-	board[105] = 'A';
-	return pos;
+
+// Put entity i on cell pos.
+void occupy(Game &game, uint32_t i, uint32_t pos) {
+	Occupancy &occupancy = game.occupancy;
+	uint32_t slot = occupancySlot(occupancy, pos);
+	if (occupancy.cells[slot] != pos) {
+		occupancy.cells[slot] = pos;
+		occupancy.first[slot] = noEntity;
+	}
+	occupancy.next[i] = occupancy.first[slot];
+	occupancy.prev[i] = noEntity;
+	if (occupancy.first[slot] != noEntity) {
+		occupancy.prev[occupancy.first[slot]] = i;
+	}
+	occupancy.first[slot] = i;
 }
 
-uint16_t checkers(char c, void (** action)(uint32_t*, uint16_t), uint32_t *data) {
-	uint16_t pos = left(c, action, data);
-	board[119] = '-';
-	for (uint8_t y = 16; y < 200; y += 15) {
-		uint8_t x = y;
-		if ((x & 1) == 0) {
-			x++;
-		}
-		while (x < y + 13) {
-			board[x] = 'B';
-			x += 2;
+
+// Take entity i off cell pos, and return whether that leaves it empty. The last one off a cell
+// empties its slot, and the cells after it that were pushed along by it are moved back, so lookups
+// never need to skip a deleted slot.
+bool vacate(Game &game, uint32_t i, uint32_t pos) {
+	Occupancy &occupancy = game.occupancy;
+	uint32_t next = occupancy.next[i];
+	uint32_t prev = occupancy.prev[i];
+	occupancy.next[i] = notPlaced;
+	if (next != noEntity) {
+		occupancy.prev[next] = prev;
+	}
+	if (prev != noEntity) {
+		occupancy.next[prev] = next;
+		return false;
+	}
+	uint32_t slot = occupancySlot(occupancy, pos);
+	occupancy.first[slot] = next;
+	if (next != noEntity) {
+		return false;
+	}
+	uint32_t mask = occupancy.cells.size() - 1;
+	uint32_t hole = slot;
+	for (uint32_t at = (slot + 1) & mask; occupancy.cells[at] != noEntity; at = (at + 1) & mask) {
+		uint32_t home = (occupancy.cells[at] * 0x9E3779B1) >> occupancy.shift;
+		if (((at - home) & mask) >= ((at - hole) & mask)) {
+			occupancy.cells[hole] = occupancy.cells[at];
+			occupancy.first[hole] = occupancy.first[at];
+			hole = at;
 		}
 	}
-	return pos;
+	occupancy.cells[hole] = noEntity;
+	return true;
 }
 
-uint16_t warpy(char c, void (** action)(uint32_t*, uint16_t), uint32_t *data) {
-	width = 11;
-	height = 15;
-	edgeWalls();
-	horizontal(25, 7, '-');
-	horizontal(48, 3, '-');
-	horizontal(61, 4, '-');
-	horizontal(105, 4, '-');
-	horizontal(126, 4, '-');
-	vertical(13, 12, '-');
-	vertical(59, 8, '-');
-	vertical(83, 2, '-');
-	board[1] = 'w';
-	board[5] = 'W';
-	board[159] = 's';
-	board[41] = '*';
-	board[85] = '*';
-	action[0] = nullptr;
-	data[1] = 41;
-	data[2] = 85;
-	if (c == 'w') {
-		return 148;
-	}
-	if (c == 's') {
-		return 12;
+
+// Move entity i's '!' from where it is to newPos. The cell it leaves is only cleared if no other
+// chaser or copier is still on it.
+void moveMover(Game &game, uint32_t i, uint32_t *pos, uint32_t newPos) {
+	if (vacate(game, i, pos[i])) {
+		put(game, pos[i], ' ');
 	}
-	return 16;
+	pos[i] = newPos;
+	occupy(game, i, newPos);
+	put(game, newPos, '!');
 }
 
 
-// Empty room with doors at the top and bottom.
-uint16_t vert(char c, void (**action)(uint32_t*, uint16_t), uint32_t *data) {
-	uint16_t pos = left(c, action, data);
-	board[119] = '-';
-	return pos;
+// Whether chaser or copier i still has its '!', keeping the occupancy table up to date with it.
+// One whose '!' was written over is out of the table, and back in once a '!' is on its cell again.
+bool hasBang(Game &game, uint32_t i, uint32_t pos) {
+	bool placed = game.occupancy.next[i] != notPlaced;
+	if (cell(game, pos) != '!') {
+		if (placed) {
+			vacate(game, i, pos);
+		}
+		return false;
+	}
+	if (!placed) {
+		occupy(game, i, pos);
+	}
+	return true;
 }
 
 
-// Room between checkers and tele.
-uint16_t postWarp(char c, void (** action)(uint32_t*, uint16_t), uint32_t *data) {
-	uint16_t pos = vert(c, action, data);
-	board[218] = 'S';
-	if (c == 'W') {
-		pos++;
+// Build the occupancy table for the room's chasers and copiers, with room for all of them at
+// under half full.
+void placeMovers(Game &game) {
+	Occupancy &occupancy = game.occupancy;
+	const uint32_t *first = game.entities.first;
+	uint32_t movers = first[kindCopy + 1] - first[kindChase];
+	uint8_t bits = 4;
+	while (((uint32_t) 1 << bits) < 2 * movers) {
+		bits++;
+	}
+	occupancy.cells.assign((size_t) 1 << bits, noEntity);
+	occupancy.first.resize((size_t) 1 << bits);
+	occupancy.next.assign(first[kindCount], notPlaced);
+	occupancy.prev.resize(first[kindCount]);
+	occupancy.shift = 32 - bits;
+	for (uint32_t i = first[kindChase]; i < first[kindCopy + 1]; i++) {
+		if (cell(game, game.entities.position[i]) == '!') {
+			occupy(game, i, game.entities.position[i]);
+		}
 	}
-	return pos;
 }
 
 
-uint16_t toKnight(char c, void (**action)(uint32_t*, uint16_t), uint32_t *data) {
-	uint16_t pos = room(c, action, data);
-	board[134] = 'D';
-	return pos;
+// Put every entity of the room in the schedule, due on the first turn unless it waits for a '?'.
+void scheduleEntities(Game &game) {
+	Schedule &schedule = game.schedule;
+	schedule.next.clear();
+	schedule.triggered.clear();
+	schedule.fired = false;
+	placeMovers(game);
+	const uint32_t *first = game.entities.first;
+	for (uint8_t kind = 0; kind < kindCount; kind++) {
+		bool triggered = ((triggeredKinds >> kind) & 1) != 0;
+		for (uint32_t i = first[kind]; i < first[kind + 1]; i++) {
+			(triggered ? schedule.triggered : schedule.next).push_back(i);
+
+			// One that starts out as if the '?' had been hit goes off right away.
+			schedule.fired |= triggered && game.entities.state[i] != 0;
+		}
+	}
 }
 
-uint16_t warpPoint(char c, void (**action)(uint32_t*, uint16_t), uint32_t *data) {
-	uint16_t pos = topRight(c, action, data);
-	board[217] = '-';
-	board[112] = '+';
-	return pos;
+
+// Have entity i updated again next turn.
+inline void wake(Game &game, uint32_t i) {
+	game.schedule.next.push_back(i);
 }
 
-uint16_t wallOdeath(char c, void (**action)(uint32_t*, uint16_t), uint32_t *data) {
-	width = 80;
-	height = 40;
-	edgeWalls();
-	board[3160] = 's';
-	horizontal(994, 14, 'B');
-	horizontal(1440, 4, '-');
-	horizontal(1765, 74, '-');
-	vertical(108, 12, '-');
-	vertical(132, 12, '-');
-	vertical(1444, 5, '-');
-	vertical(2918, 3, '-');
-	vertical(2919, 3, '-');
-	vertical(2921, 3, '-');
-	vertical(2922, 3, '-');
-	board[1602] = '*';
-	board[1677] = '*';
-	data[1] = 1602;
-	data[2] = 1677;
-	if (c == 'a') {
-		action[0] = destroy;
-		action[1] = nullptr;
-		data[0] = 3121;
-		return 158;
+
+// Where pos is in the flow field's window, or -1 if it's outside.
+inline int32_t flowIndex(const Game &game, uint32_t pos) {
+	const FlowField &flow = game.flow;
+	uint16_t y = rowOf(game, pos);
+	uint16_t x = pos - (uint32_t) y * game.width;
+	if (x < flow.left || x - flow.left >= flow.width || y < flow.top || y - flow.top >= flow.height) {
+		return -1;
 	}
-	action[0] = nullptr;
-	return 3080;
+	return (int32_t) (y - flow.top) * flow.width + (x - flow.left);
 }
 
 
-// This room has two enemies which copy your movements.
-uint16_t copyCats(char c, void (**action)(uint32_t*, uint16_t), uint32_t *data) {
-	width = 18;
-	height = 12;
-	edgeWalls();
-	horizontal(38, 15, '-');
-	horizontal(56, 15, '-');
-	horizontal(91, 14, '-');
-	horizontal(109, 14, '-');
-	board[16] = 'w';
-	board[126] = 'a';
-	board[206] = 's';
-	board[134] = '!';
-	action[0] = copy;
-	data[0] = 134;
-	if (c == 's') {
-		action[1] = nullptr;
-		return 34;
-	}
-	board[34] = '!';
-	action[1] = copy;
-	data[1] = 34;
-	action[2] = nullptr;
-	if (c == 'w') {
-		return 188;
-	}
-	return 127;
+// The steps from the player to cell at of the flow field's window, or flowUnseen if the search
+// hasn't got there.
+inline uint16_t flowSteps(const FlowField &flow, int32_t at) {
+	uint32_t entry = flow.steps[at];
+	return entry >> 16 == flow.search ? entry & 0xFFFF : flowUnseen;
 }
 
 
-// This room is below the labyrinth room and has an optional puzzle.
-uint16_t underLab(char c, void (**action)(uint32_t*, uint16_t), uint32_t *data) {
-	width = 10;
-	height = 13;
-	edgeWalls();
-	board[23] = 'B';
-	board[74] = 'B';
-	board[76] = 'B';
-	board[5] = 'w';
-	board[121] = 's';
-	board[128] = 'S';
-	horizontal(63, 2, '-');
-	horizontal(66, 3, '-');
-	horizontal(84, 3, '-');
-	horizontal(107, 2, 'B');
-	horizontal(33, 2, 'B');
-	horizontal(36, 3, 'B');
-	horizontal(44, 5, 'B');
-	vertical(22, 10, '-');
-	action[0] = nullptr;
-	if (c == 'w') {
-		return 111;
-	}
-	if (c == 'W') {
-		return 118;
+// Whether the cell at column and row of the flow field's window is solid. Reads the row in from the
+// solid bits the first time a search of this layout asks about it.
+inline bool flowWall(Game &game, uint16_t column, uint16_t row) {
+	FlowField &flow = game.flow;
+	uint16_t words = (flow.width + tileSide - 1) >> tileShift;
+	uint64_t *line = flow.walls.data() + (size_t) row * words;
+	if (flow.wallsFrom[row] != flow.layout) {
+		flow.wallsFrom[row] = flow.layout;
+		for (uint16_t w = 0; w < words; w++) {
+			line[w] = solidRow(game, flow.left + (w << tileShift), flow.top + row);
+		}
 	}
-	return 15;
+	return (line[column >> tileShift] >> (column & (tileSide - 1)) & 1) != 0;
 }
 
 
-// This room comes right before the room where you get the sticky.
-uint16_t toSticky(char c, void (**action)(uint32_t*, uint16_t), uint32_t *data) {
-	width = 17;
-	height = 17;
-	edgeWalls();
-	board[95] = '-';
-	board[8] = 'w';
-	board[136] = 'a';
-	board[280] = 's';
-	horizontal(18, 7, 'B');
-	horizontal(26, 7, 'B');
-	action[0] = nullptr;
-	switch(c) {
-		case 'w':
-			return 263;
-		case 's':
-			return 25;
-		default:
-			return 137;
+// Whether the flow field's window still has room around a player at column playerX of row playerY.
+bool flowCentred(const Game &game, uint16_t playerX, uint16_t playerY) {
+	const FlowField &flow = game.flow;
+	const uint16_t margin = flowRadius / 2;
+	if (flow.from == flowNowhere) {
+		return false;
 	}
+	bool across = (flow.left == 0 || playerX >= flow.left + margin) &&
+			(flow.left + flow.width == game.width || playerX + margin < flow.left + flow.width);
+	bool down = (flow.top == 0 || playerY >= flow.top + margin) &&
+			(flow.top + flow.height == game.height || playerY + margin < flow.top + flow.height);
+	return across && down;
 }
 
 
-// This room is near the bottom of the map and has w, W, and d doors.
-uint16_t corner(char c, void (**action)(uint32_t*, uint16_t), uint32_t *data) {
-	uint16_t pos = bottomLeft(c, action, data);
-	if (c == 'S') {
-		pos++;
+// Start a new layout, forgetting the walls and regions of the last one.
+void newFlowLayout(Game &game) {
+	FlowField &flow = game.flow;
+	if (++flow.layout == 0) {
+		std::fill(flow.wallsFrom.begin(), flow.wallsFrom.end(), 0);
+		std::fill(flow.regions.begin(), flow.regions.end(), 0);
+		flow.layout = 1;
 	}
-	board[8] = 'W';
-	return pos;
+	flow.walled = game.wallChanges;
 }
 
 
-// This room requires you to shove a block through kill thingies.
-uint16_t shield(char c, void (**action)(uint32_t*, uint16_t), uint32_t *data) {
-	width = 9;
-	height = 15;
-	edgeWalls();
-	board[24] = 'B';
-	board[113] = 'B';
-	board[4] = 'w';
-	board[130] = 's';
-	for(uint16_t i = 37; i < 44; i++) {
-		vertical(i, 7, '!');
+// Work out the flow field around x for the chasers listed in due.
+void buildFlow(Game &game, uint32_t x, const uint32_t *pos, const uint32_t *due, uint32_t count) {
+	FlowField &flow = game.flow;
+	uint16_t playerY = rowOf(game, x);
+	uint16_t playerX = x - (uint32_t) playerY * game.width;
+	bool moved = flow.from != x;
+	if (!flowCentred(game, playerX, playerY)) {
+		flow.left = playerX > flowRadius ? playerX - flowRadius : 0;
+		flow.top = playerY > flowRadius ? playerY - flowRadius : 0;
+		flow.width = std::min<uint32_t>(game.width, playerX + flowRadius + 1) - flow.left;
+		flow.height = std::min<uint32_t>(game.height, playerY + flowRadius + 1) - flow.top;
+		uint32_t area = (uint32_t) flow.width * flow.height;
+		if (flow.steps.size() < area) {
+			flow.steps.resize(area, 0);
+			flow.queue.resize(area);
+			flow.regions.resize(area, 0);
+		}
+		if (flow.wallsFrom.size() < flow.height) {
+			flow.wallsFrom.resize(flow.height, 0);
+		}
+		flow.walls.resize((size_t) flow.height * ((flow.width + tileSide - 1) >> tileShift));
+		newFlowLayout(game);
+		moved = true;
 	}
-	if (c == 'w') {
-		return 121;
+	else if (flow.walled != game.wallChanges) {
+		newFlowLayout(game);
+		moved = true;
 	}
-	return 13;
-}
+	if (moved) {
 
+		// Entries from earlier searches don't count, so there's no clearing the window first.
+		// Only once the search number comes back round does it have to be done, and then the
+		// regions, which are named after searches, have to go too.
+		if (++flow.search == 0) {
+			std::fill(flow.steps.begin(), flow.steps.end(), 0);
+			flow.search = 1;
+			newFlowLayout(game);
+		}
 
-// This room looks like a penguin.
-uint16_t logo(char c, void (**action)(uint32_t*, uint16_t), uint32_t *data) {
-	width = 45;
-	height = 31;	
-	edgeWalls();
-	board[514] = 'B';
-	board[608] = 'B';
-	board[748] = 'B';
-	board[779] = 'B';
-	board[963] = 'B';
-	board[973] = 'B';
-	board[1001] = 'B';
-	board[1090] = 'B';
-	board[1113] = 'B';
-	board[1144] = 'B';
-	board[1149] = 'B';
-	board[21] = 'w';
-	board[1371] = 's';
-	horizontal(289, 4, 'B');
-	horizontal(333, 6, 'B');
-	horizontal(378, 7, 'B');
-	horizontal(425, 2, 'B');
-	horizontal(428, 2, 'B');
-	horizontal(470, 2, 'B');
-	horizontal(650, 3, 'B');
-	horizontal(1009, 2, 'B');
-	horizontal(1100, 4, 'B');
-	horizontal(1136, 3, 'B');
-	horizontal(1155, 3, 'B');
-	horizontal(1183, 6, 'B');
-	horizontal(1195, 6, 'B');
-	vertical(423, 4, 'B');
-	vertical(778, 4, 'B');
-	vertical(794, 4, 'B');
-	vertical(822, 3, 'B');
-	vertical(840, 3, 'B');
-	vertical(841, 4, 'B');
-	vertical(887, 4, 'B');
-	leftDiag(557, 5, 'B');
-	leftDiag(646, 3, 'B');
-	leftDiag(956, 3, 'B');
-	leftDiag(972, 5, 'B');
-	rightDiag(474, 7, 'B');
-	rightDiag(518, 2, 'B');
-	rightDiag(519, 7, 'B');
-	rightDiag(558, 2, 'B');
-	rightDiag(914, 2, 'B');
-	rightDiag(915, 6, 'B');
-	rightDiag(916, 3, 'B');
-	rightDiag(976, 2, 'B');
-	rightDiag(977, 3, 'B');
-	action[0] = nullptr;
-	if (c == 'w') {
-		return 1326;
+		// The queue holds the row of each cell in its top half and the column in its bottom half.
+		int32_t at = flowIndex(game, x);
+		flow.steps[at] = (uint32_t) flow.search << 16;
+		flow.queue[0] = (uint32_t) (playerY - flow.top) << 16 | (playerX - flow.left);
+		flow.head = 0;
+		flow.tail = 1;
+		flow.from = x;
+		flow.region = flow.regions[at] >> 16 == flow.layout ? flow.regions[at] : 0;
 	}
-	return 66;
-}
+	uint32_t stamp = (uint32_t) flow.search << 16;
+	uint32_t *steps = flow.steps.data();
 
+	// Mark the cells the search still has to get to. Once it's reached all of them there's nothing
+	// to do, and if the player's region is known, the ones outside it can't be got to.
+	uint32_t wanted = 0;
+	for (uint32_t k = 0; k < count; k++) {
+		int32_t at = flowIndex(game, pos[due[k]]);
+		if (at >= 0 && steps[at] >> 16 != flow.search && cell(game, pos[due[k]]) == '!' &&
+				(flow.region == 0 || flow.regions[at] == flow.region)) {
+			steps[at] = stamp | flowWanted;
+			wanted++;
+		}
+	}
 
-int main() {
-	const uint8_t mapWidth = 11;
-	const uint8_t start = 90;
-	const uint8_t cage = 78;
-	const uint8_t warpRoom = 24;
-	const uint8_t knight = 98;
-	const uint8_t grab = 45;
-	uint32_t moves = 0;
-	printf("\n\n\nWelcome to puzzle-land.\nYour objective is to find a circular item (It looks like the letter 'o').\nIt shouldn't be far from your starting location.\nwasd - move\nt - close\nx - reset room\nAny other key - wait\nPress enter to continue.\n");
-	flags = 0;
-	input = getchar();
-	if (input == 'C') {
-		flags = 14;
-	}
-	uint16_t (*initialize[121])(char, void (**)(uint32_t*, uint16_t), uint32_t*) =  {	nullptr,	nullptr,	nullptr,	topLeft,	top,	top,	top,	top,	top,		topRight,		nullptr,
-																						nullptr,	nullptr,	nullptr,	vert,		left,	room,	room,	room,	room,		right,			nullptr,
-																						nullptr,	wallOdeath,	warpPoint,	vert,		left,	room,	room,	room,	room,		right,			nullptr,
-																						nullptr,	bottomLeft,	copyCats,	tele,		left,	room,	room,	cheese,	room,		right,			nullptr,
-																						down,		powerGrip,	logo,		postWarp,	left,	room,	room,	room,	room,		right,			nullptr,
-																						bottomLeft,	toSticky,	mudRoom,	checkers,	left,	room,	room,	room,	room,		right,			nullptr,
-																						nullptr,	blocks,		hall,		warpy,		left,	room,	room,	room,	room,		right,			nullptr,
-																						nullptr,	prison,		bigRoom,	labyrinth,	room,	room,	room,	room,	room,		right,			nullptr,
-																						nullptr,	blockRoom,	frontRoom,	underLab,	left,	room,	room,	room,	room,		right,			knightsMove,
-																						nullptr,	nullptr,	finalRoom,	shield,		left,	room,	room,	room,	toKnight,	right,			up,
-																						nullptr,	nullptr,	nullptr,	corner,		bottom,	bottom,	bottom,	bottom,	bottom,		bottomRight,	nullptr};
-	void (*action[10])(uint32_t*, uint16_t);
-	uint32_t data[10];
-	char entrance = 'w';
-	uint8_t roomNum = start;
-	input = ' ';
-	uint16_t warp = 0;
-	uint16_t position = (initialize[roomNum])(' ', action, data);
-	termios oldt = noCanon();
-	while (input != 't') {
-		uint16_t block = 0;
-		if ((flags & 1) == 1) {
-			initialize[cage] = secret;
-			flags &= 0xFE;
-		}
-		print();
-		input = (char) getchar();
-		moves++;
-		uint16_t newPosition = position;
-		switch (input) {
-			case 'w':
-				block = position + width;
-				newPosition -= width;
-				break;
-			case 'a':
-				block = position + 1;
-				newPosition--;
-				break;
-			case 's':
-				block = position - width;
-				newPosition += width;
-				break;
-			case 'd':
-				block = position - 1;
-				newPosition++;
-				break;
-			case 'r':
-				clear(warp, '@');
-				warp = position;
-				break;
-			case 'f':
-				if ((flags & 2) == 2 && warp != 0) {
-					newPosition = warp;
-				}
-				break;
-			case 'e':
-				if ((flags & 0x28) == 0x28) {
-					flags &= 0xDF;
-				}
-				else if ((flags & 8) == 8) {
-					flags |= 0x20;
-				}
-				break;
-			case 'x':
-				newPosition = initialize[roomNum](entrance, action, data);
+	uint32_t *queue = flow.queue.data();
+	uint32_t head = flow.head;
+	uint32_t tail = flow.tail;
+	while (head < tail && wanted > 0) {
+		uint16_t row = queue[head] >> 16;
+		uint16_t column = queue[head++] & 0xFFFF;
+		uint32_t at = (uint32_t) row * flow.width + column;
+		uint32_t further = steps[at] + 1;
+		uint32_t next[4];
+		uint32_t cells[4];
+		uint8_t found = 0;
+		if (column > 0) {
+			next[found] = at - 1;
+			cells[found++] = queue[head - 1] - 1;
 		}
-		if ((flags & 4) == 4) {
-			moveKnight(position, &newPosition);
+		if (column + 1 < flow.width) {
+			next[found] = at + 1;
+			cells[found++] = queue[head - 1] + 1;
 		}
-		for (uint8_t i = 0; action[i] != nullptr; i++) {
-			(action[i])(data + i, position);
+		if (row > 0) {
+			next[found] = at - flow.width;
+			cells[found++] = queue[head - 1] - 0x10000;
 		}
-		if (board[newPosition] == '-') {
-			newPosition = position;
+		if (row + 1 < flow.height) {
+			next[found] = at + flow.width;
+			cells[found++] = queue[head - 1] + 0x10000;
 		}
-		else if (board[newPosition] == 'B') {
-			uint16_t blockPos;
-			switch (input) {
-				case 'w':
-					blockPos = newPosition - width;
-					break;
-				case 'a':
-					blockPos = newPosition - 1;
-					break;
-				case 's':
-					blockPos = newPosition + width;
-					break;
-				case 'd':
-					blockPos = newPosition + 1;
-					break;
-				default:
-					blockPos = newPosition;
-					newPosition = position;
-			}
-			if (board[blockPos] == '-' || board[blockPos] == 'B' || board[blockPos] == 'w' || board[blockPos] == 'a'|| board[blockPos] == 's'|| board[blockPos] == 'd' || board[blockPos] == 'W' || board[blockPos] == 'A'|| board[blockPos] == 'S'|| board[blockPos] == 'D') {
-				newPosition = position;
+		for (uint8_t j = 0; j < found; j++) {
+			uint32_t entry = steps[next[j]];
+			if (entry >> 16 == flow.search && (entry & 0xFFFF) < flowWanted) {
+				continue;
 			}
-			else {
-				board[blockPos] = 'B';
+			if (flowWall(game, cells[j] & 0xFFFF, cells[j] >> 16)) {
+				steps[next[j]] = stamp | flowBlocked;
+				continue;
 			}
+			wanted -= entry == (stamp | flowWanted);
+			steps[next[j]] = further;
+			queue[tail++] = cells[j];
 		}
-		switch (board[newPosition]) {
-			case 'w':
-				roomNum -= mapWidth;
-				newPosition = (initialize[roomNum])('w', action, data);
-				entrance = 'w';
-				warp = 0;
-				break;
-			case 'W':
-				roomNum -= 2 * mapWidth;
-				newPosition = (initialize[roomNum])('W', action, data);
-				entrance = 'W';
-				warp = 0;
-				break;
-			case 'a':
-				newPosition = (initialize[--roomNum])('a', action, data);
-				entrance = 'a';
-				warp = 0;
-				break;									
-			case 'A':
-				roomNum -= 2;
-				newPosition = (initialize[roomNum])('A', action, data);
-				entrance = 'A';
-				warp = 0;
-				break;									
-			case 's':
-				roomNum += mapWidth;
-				newPosition = (initialize[roomNum])('s', action, data);
-				entrance = 's';
-				warp = 0;
-				break;
-			case 'S':
-				roomNum += 2 * mapWidth;
-				newPosition = (initialize[roomNum])('S', action, data);
-				entrance = 'S';
-				warp = 0;
-				break;
-			case 'd':
-				newPosition = (initialize[++roomNum])('d', action, data);
-				entrance = 'd';
-				warp = 0;
-				break;
-			case 'D':
-				roomNum += 2;
-				newPosition = (initialize[roomNum])('D', action, data);
-				entrance = 'D';
-				warp = 0;
-				break;									
-			case '!':
-				tcsetattr(STDIN_FILENO, TCSANOW, &oldt);
-				print();
-				printf("\n\nGame over.\n\n");
-				return 1;				
-			case '?':
-				data[0] |= 0x80000000;
-				break;
-			case '*':
-				if (data[1] == newPosition) {
-					newPosition = data[2];
-				}
-				else {
-					newPosition = data[1];
-				}
-				switch (input) {
-					case 'w':
-						newPosition -=  width;
-						break;
-					case 'a':
-						newPosition--;
-						break;
-					case 's':
-						newPosition += width;
-						break;
-					case 'd':
-						newPosition++;
-						break;
-					default:
-						newPosition = position;
+	}
+	flow.head = head;
+	flow.tail = tail;
+
+	// Out of cells, so everything the search reached is the player's region.
+	if (head == tail && flow.region == 0) {
+		flow.region = (uint32_t) flow.layout << 16 | flow.search;
+		for (uint32_t k = 0; k < tail; k++) {
+			flow.regions[(queue[k] >> 16) * flow.width + (queue[k] & 0xFFFF)] = flow.region;
+		}
+	}
+}
+
+
+// Moves each chasing '!' one space towards x, around walls if the flow field shows a way.
+void chase(Game &game, uint32_t *pos, const uint32_t *due, uint32_t count, uint32_t x) {
+	buildFlow(game, x, pos, due, count);
+	const FlowField &flow = game.flow;
+	uint16_t xHor = x % game.width;
+	for (uint32_t k = 0; k < count; k++) {
+		uint32_t i = due[k];
+		wake(game, i);	// A '!' can turn up where a lost one was, so it has to keep looking.
+		if (!hasBang(game, i, pos[i])) {
+			continue;
+		}
+
+		// Figure out where '!' needs to move to.
+		uint16_t posHor = pos[i] - rowOf(game, pos[i]) * game.width;
+		uint32_t newPos = pos[i];
+		if (xHor > posHor) {
+			newPos++;
+		}
+		else if (xHor < posHor) {
+			newPos--;
+		}
+		else if (x > pos[i]) {
+			newPos += game.width;
+		}
+		else {
+			newPos -= game.width;
+		}
+
+		// Where the search got to the '!', go one step down the field instead if moving towards x
+		// isn't. In the open it always is, so the field only changes anything around walls.
+		int32_t at = flowIndex(game, pos[i]);
+		uint16_t here = at >= 0 ? flowSteps(flow, at) : flowUnseen;
+		if (here > 0 && here < flowBlocked) {
+			int32_t toward = flowIndex(game, newPos);
+			uint16_t down = here - 1;
+			uint16_t column = at % flow.width;
+			if (toward < 0 || flowSteps(flow, toward) != down) {
+				if (column > 0 && flowSteps(flow, at - 1) == down) {
+					newPos = pos[i] - 1;
 				}
-				break;
-			case '+':
-				if (roomNum == warpRoom) {
-					flags |= 2;
-					warp = 0;
-					flags &= 0xDF;
-					printf("You found the warp point! Good for you!\nPress 'r' and 'f' to use it.\nPress any key to continue.\n");
-					getchar();
+				else if (column + 1 < flow.width && flowSteps(flow, at + 1) == down) {
+					newPos = pos[i] + 1;
 				}
-				else if (roomNum == knight) {
-					flags |= 4;
-					clear(warp, '@');
-					warp = 0;
-					flags &= 0xDF;
-					printf("You found the knight's move! Nice.\nUse it with y, u, i, o, h, j, k, and l.\nPress any key to continue.\n");
-					getchar();
+				else if (at >= flow.width && flowSteps(flow, at - flow.width) == down) {
+					newPos = pos[i] - game.width;
 				}
 				else {
-					flags |= 8;
-					flags &= 0xDF;
-					clear(warp, '@');
-					warp = 0;
-					printf("You found the sticky.\nPress e to use it.\nPress any key to continue.\n");
-					getchar();
-				}
-				break;
-			case 'c':
-				flags |= 0x10;
-				printf("You found some moldy cream cheese.\nMaybe if you cut the moldy parts off it might still be useful for something.\nPress any key to continue.\n");
-				getchar();
-				break;
-			case 'o':
-				tcsetattr(STDIN_FILENO, TCSANOW, &oldt);
-				print();
-				printf("\n\nCongradulations!!! You found your bagel!\nUnfortunately, it's stale. :(\n");
-				if ((flags & 0x10) == 0x10) {
-					printf("With a bit of cream cheese, though, it isn't too bad.\n");
+					newPos = pos[i] + game.width;	// The search came from somewhere, so this is it.
 				}
-				printf("Well, you won. I hope you had fun.\n\nMoves taken: %u\n\n", moves);
-				return 2;	
+			}
+		}
+
+		// Check if there's a wall in the way. newPos is never where the '!' is, so a '!' that stays can be left alone.
+		if ((traits(game, newPos) & traitSolid) == 0) {
+			moveMover(game, i, pos, newPos);
+		}
+	}
+}
+
+
+// Causes each copying '!' to imitate the players actions.
+void copy(Game &game, uint32_t *pos, const uint32_t *due, uint32_t count) {
+	int32_t move = 0;
+	switch (game.input) {
+		case 'w':
+			move = -game.width;
+			break;
+		case 'a':
+			move = -1;
+			break;
+		case 's':
+			move = game.width;
+			break;
+		case 'd':
+			move = 1;
+	}
+	for (uint32_t k = 0; k < count; k++) {
+		uint32_t i = due[k];
+		wake(game, i);
+		if (!hasBang(game, i, pos[i])) {
+			continue;
+		}
+
+		// Figure out where to move to.
+		uint32_t newPosition = pos[i] + move;
+		moveKnight(game, pos[i], &newPosition);
+
+		// Check if new position is clear. A '!' counts as clear, so one that stays can be left alone.
+		if (newPosition != pos[i] && (traits(game, newPosition) & traitClear) != 0) {
+			moveMover(game, i, pos, newPosition);
+		}
+	}
+}
+
+
+// Make each '!' waddle back and forth between its position and the cell after. Its state is
+// set while it's on the cell after.
+// Used in hall.
+void danger(Game &game, const uint32_t *pos, uint32_t *after, const uint32_t *due, uint32_t count) {
+	for (uint32_t k = 0; k < count; k++) {
+		uint32_t i = due[k];
+		clear(game, pos[i] + after[i], '!');
+		after[i] ^= 1;
+		put(game, pos[i] + after[i], '!');
+		wake(game, i);
+	}
+}
+
+
+// Makes the '?' at each position blink in and out of existence. If '?' is hit, door appears and flag set.
+// Used in prison.
+void button(Game &game, const uint32_t *pos, uint32_t *signal, const uint32_t *due, uint32_t count) {
+	for (uint32_t k = 0; k < count; k++) {
+		uint32_t i = due[k];
+
+		// If ? is hit.
+		if (signal[i] != 0) {
+			put(game, pos[i] + 8, 'd');	// Make door.
+			game.flags |= 1;			// The prison is replaced by the secret room from now on.
 		}
-		if ((flags & 0x20) == 0x20 && position != newPosition && board[block] == 'B') {
-			board[block] = ' ';
-			board[position] = 'B';
+
+		// Blink in and out of existence.
+		if (cell(game, pos[i]) == ' ') {
+			put(game, pos[i], '?');
 		}
 		else {
-			clear(position, 'X');
+			put(game, pos[i], ' ');
 		}
-		position = newPosition;
-		if ((flags & 2) == 2 && board[warp] == ' ') {
-			board[warp] = '@';
+		wake(game, i);
+	}
+}
+
+
+// Makes the doors appear when the ? in blocks is hit.
+void reveal(Game &game, const uint32_t *pos, uint32_t *signal, const uint32_t *due, uint32_t count) {
+	for (uint32_t k = 0; k < count; k++) {
+		uint32_t i = due[k];
+		if (signal[i] != 0) {
+			put(game, pos[i], 'w');
+			put(game, pos[i] + 84, 's');
 		}
-		board[position] = 'X';
 	}
-	printf("\n\nExiting...\n\n");
-	tcsetattr(STDIN_FILENO, TCSANOW, &oldt);
-	return 0;
-}
\ No newline at end of file
+}
+
+
+// Makes a giant wall of !'s spawn above each position and gradually move up, from its column to
+// the right wall. The position is on the bottom wall, and the state is how many rows it's risen.
+void destroy(Game &game, const uint32_t *pos, uint32_t *state, const uint32_t *due, uint32_t count) {
+	for (uint32_t k = 0; k < count; k++) {
+		uint32_t i = due[k];
+		uint32_t bottom = rowOf(game, pos[i]);
+		uint16_t span = game.width - 1 - pos[i] % game.width;
+		uint32_t up = ++state[i];	// Move up.
+
+		// If still inside the outer wall, replace the next layer of stuff with !'s.
+		if (up < bottom) {
+			horizontal(game, pos[i] - up * game.width, span, '!');
+		}
+
+		// If wall o death has progressed a bit, let the back of the wall o death fade.
+		if (up > 3 && up < bottom + 3) {
+			horizontal(game, pos[i] - (up - 3) * game.width, span, ' ');
+		}
+
+		// If the wall o death has left the room, stop messing with it. It's done for good then.
+		else if (up >= bottom + 3) {
+			continue;
+		}
+		wake(game, i);
+	}
+}
+
+
+// Makes walls of !'s travel horizontally across the band at each position.
+void killHor(Game &game, const uint32_t *pos, uint32_t *state, const uint32_t *due, uint32_t count) {
+	for (uint32_t k = 0; k < count; k++) {
+		uint32_t i = due[k];
+		uint32_t along = state[i] >> killAlongShift;
+		vertical(game, pos[i] + along, killHeight, ' ');
+		along = (along + ((state[i] & killForward) != 0 ? 1 : killWidth - 1)) % killWidth;
+		vertical(game, pos[i] + along, killHeight, '!');
+		state[i] = along << killAlongShift | (state[i] & killForward);
+		wake(game, i);
+	}
+}
+
+
+// Makes walls of !'s travel vertically down the band at each position.
+void killVert(Game &game, const uint32_t *pos, uint32_t *state, const uint32_t *due, uint32_t count) {
+	for (uint32_t k = 0; k < count; k++) {
+		uint32_t i = due[k];
+		uint32_t along = state[i] >> killAlongShift;
+		horizontal(game, pos[i] + along * game.width, killWidth, ' ');
+		along = (along + ((state[i] & killForward) != 0 ? 1 : killHeight - 1)) % killHeight;
+		horizontal(game, pos[i] + along * game.width, killWidth, '!');
+		state[i] = along << killAlongShift | (state[i] & killForward);
+		wake(game, i);
+	}
+}
+
+
+// Blocks the door the player entered from and creates a new one that's obnoxious to get to.
+// Used in knightsMove.
+void knight(Game &game, const uint32_t *pos, uint32_t *signal, const uint32_t *due, uint32_t count) {
+	for (uint32_t k = 0; k < count; k++) {
+		uint32_t i = due[k];
+		if (signal[i] != 0) {
+			put(game, pos[i], '-');
+			put(game, pos[i] - 120, 'a');
+		}
+	}
+}
+
+// Spawns a line of B's that overlaps with one of the walls.
+// Used in final room.
+void change(Game &game, const uint32_t *pos, uint32_t *signal, const uint32_t *due, uint32_t count) {
+	for (uint32_t k = 0; k < count; k++) {
+		uint32_t i = due[k];
+		if (signal[i] != 0) {
+			vertical(game, pos[i], 5, 'B');
+			signal[i] = 0;
+		}
+	}
+}
+
+
+// Update the entities due this turn, a kind at a time. x is where the player was at the start of the turn.
+void updateEntities(Game &game, uint32_t x) {
+	Schedule &schedule = game.schedule;
+	std::vector<uint32_t> &due = schedule.due;
+	due.clear();
+	due.swap(schedule.next);
+	if (schedule.fired) {
+		schedule.fired = false;
+		due.insert(due.end(), schedule.triggered.begin(), schedule.triggered.end());
+		std::sort(due.begin(), due.end());
+	}
+
+	// due is in index order, so each kind is a run of it.
+	const uint32_t *first = game.entities.first;
+	uint32_t *pos = game.entities.position.data();
+	uint32_t *state = game.entities.state.data();
+	uint32_t start = 0;
+	for (uint8_t kind = 0; kind < kindCount && start < due.size(); kind++) {
+		uint32_t end = start;
+		while (end < due.size() && due[end] < first[kind + 1]) {
+			end++;
+		}
+		const uint32_t *run = due.data() + start;
+		uint32_t count = end - start;
+		start = end;
+		if (count == 0) {
+			continue;
+		}
+		switch (kind) {
+			case kindChange:
+				change(game, pos, state, run, count);
+				break;
+			case kindButton:
+				button(game, pos, state, run, count);
+				break;
+			case kindReveal:
+				reveal(game, pos, state, run, count);
+				break;
+			case kindKnight:
+				knight(game, pos, state, run, count);
+				break;
+			case kindDanger:
+				danger(game, pos, state, run, count);
+				break;
+			case kindDestroy:
+				destroy(game, pos, state, run, count);
+				break;
+			case kindChase:
+				chase(game, pos, run, count, x);
+				break;
+			case kindCopy:
+				copy(game, pos, run, count);
+				break;
+			case kindKillHor:
+				killHor(game, pos, state, run, count);
+				break;
+			case kindKillVert:
+				killVert(game, pos, state, run, count);
+		}
+	}
+}
+
+
+// A room's starting board, built by the compiler. Every room initializer keeps its
+// layout in a static constexpr Layout, so the walls are baked into the binary and
+// entering a room is a single copy. Writing outside the room is not a constant
+// expression, so a bad index in a layout fails the build instead of the game.
+template <uint8_t W, uint8_t H>
+struct Layout {
+	static_assert(W * H <= builtCells, "Room is too big to build.");
+
+	char cells[W * H];
+
+	constexpr Layout() : cells{} {}
+
+	constexpr void put(uint16_t pos, char c) {
+		cells[pos] = pos < W * H ? c : throw "Layout index out of range.";
+	}
+
+	// These mirror the runtime line helpers, including how they wrap.
+	constexpr void horizontal(uint16_t start, uint8_t length, char c) {
+		for (uint8_t i = 0; i < length; i++) {
+			put(start + i, c);
+		}
+	}
+
+	constexpr void vertical(uint16_t start, uint16_t length, char c) {
+		length *= W;
+		for (uint16_t i = 0; i < length; i += W) {
+			put(start + i, c);
+		}
+	}
+
+	constexpr void leftDiag(uint16_t start, uint16_t length, char c) {
+		length *= W - 1;
+		for (uint16_t i = 0; i < length; i += W - 1) {
+			put(start + i, c);
+		}
+	}
+
+	constexpr void rightDiag(uint16_t start, uint16_t length, char c) {
+		length *= W + 1;
+		for (uint16_t i = 0; i < length; i += W + 1) {
+			put(start + i, c);
+		}
+	}
+
+	constexpr void horizontalWall(uint16_t start, uint8_t length) {
+		horizontal(start, length, '-');
+	}
+
+	constexpr void verticalWall(uint16_t start, uint16_t length) {
+		vertical(start, length, '-');
+	}
+
+	constexpr void leftDiagWall(uint16_t start, uint16_t length) {
+		leftDiag(start, length, '-');
+	}
+
+	constexpr void rightDiagWall(uint16_t start, uint16_t length) {
+		rightDiag(start, length, '-');
+	}
+
+	// Make walls around the edge of the room and empty the middle.
+	constexpr void edgeWalls() {
+		horizontalWall(0, W);
+		for (uint8_t i = 1; i < H - 1; i++) {
+			put(i * W, '-');
+			for (uint8_t j = 1; j < W - 1; j++) {
+				put(W * i + j, ' ');
+			}
+			put(W * (i + 1) - 1, '-');
+		}
+		horizontalWall(W * (H - 1), W);
+	}
+};
+
+
+// Copy a layout onto the board.
+template <uint8_t W, uint8_t H>
+void load(Game &game, const Layout<W, H> &layout) {
+	loadCells(game, W, H, layout.cells);
+	touchAll(game);
+}
+
+
+constexpr Layout<10, 10> mudRoomLayout() {
+	Layout<10, 10> layout;
+	layout.horizontalWall(0, 10);
+	for (uint8_t i = 1; i < 9; i++) {
+		layout.put(i * 10, '-');
+		for (uint8_t j = 1; j < 9; j++) {
+			layout.put(10 * i + j, 'm');
+		}
+		layout.put(10 * (i + 1) - 1, '-');
+	}
+	layout.horizontalWall(90, 10);
+	layout.put(5, 'w');
+	layout.put(95, 's');
+	layout.put(45, '!');
+	return layout;
+}
+
+// A room with an enemy that chases you and a bunch of pointless m's that disapear when you step on them.
+uint16_t mudRoom(Game &game, char c) {
+	static constexpr Layout<10, 10> layout = mudRoomLayout();
+	load(game, layout);
+	addEntity(game, kindChase, 45, 0);
+	if (c == 'w') {
+		return 85;
+	}
+	else {
+		return 15;
+	}
+}
+
+constexpr Layout<7, 13> blocksLayout() {
+	Layout<7, 13> layout;
+	layout.edgeWalls();
+	layout.horizontal(29, 2, 'B');
+	layout.horizontal(32, 2, 'B');
+	layout.horizontal(57, 2, 'B');
+	layout.horizontal(60, 2, 'B');
+	layout.horizontal(43, 2, '-');
+	layout.horizontal(46, 2, '-');
+	layout.put(9, 'B');
+	layout.put(11, 'B');
+	layout.put(17, 'B');
+	layout.put(38, 'B');
+	layout.put(52, 'B');
+	layout.put(73, 'B');
+	layout.put(79, 'B');
+	layout.put(81, 'B');
+	layout.put(45, '?');
+	// layout.put(35, 'a');
+	return layout;
+}
+
+uint16_t blocks(Game &game, char c) {
+	static constexpr Layout<7, 13> layout = blocksLayout();
+	load(game, layout);
+	addEntity(game, kindReveal, 3, 0);
+	if (c == 'w') {
+		put(game, 87, 's');
+		return 80;
+	}
+	else {
+		put(game, 3, 'w');
+		return 10;
+	}
+}
+
+constexpr Layout<5, 40> hallLayout() {
+	Layout<5, 40> layout;
+	layout.edgeWalls();
+	layout.put(2, 'w');
+	layout.put(197, 's');
+	layout.put(81, '!');
+	return layout;
+}
+
+uint16_t hall(Game &game, char c) {
+	static constexpr Layout<5, 40> layout = hallLayout();
+	load(game, layout);
+	addEntity(game, kindDanger, 81, 1);
+	if (c == 'w') {
+		return 192;
+	}
+	else {
+		return 7;
+	}
+}
+
+constexpr Layout<7, 11> teleLayout() {
+	Layout<7, 11> layout;
+	layout.edgeWalls();
+	layout.horizontal(36, 5, '-');
+	layout.put(24, '*');
+	layout.put(52, '*');
+	layout.put(3, 'w');
+	layout.put(73, 's');
+	return layout;
+}
+
+uint16_t tele(Game &game, char c) {
+	static constexpr Layout<7, 11> layout = teleLayout();
+	load(game, layout);
+	game.teleport[0] = 24;
+	game.teleport[1] = 52;
+	if (c == 'w') {
+		return 66;
+	}
+	else {
+		return 10;
+	}
+}
+
+constexpr Layout<5, 5> prisonLayout() {
+	Layout<5, 5> layout;
+	layout.edgeWalls();
+	return layout;
+}
+
+uint16_t prison(Game &game, char c) {
+	static constexpr Layout<5, 5> layout = prisonLayout();
+	load(game, layout);
+	addEntity(game, kindButton, 6, 0);
+	return 12;
+}
+
+constexpr Layout<7, 10> secretLayout() {
+	Layout<7, 10> layout;
+	layout.edgeWalls();
+	layout.put(16, '-');
+	layout.put(18, '-');
+	layout.put(37, '-');
+	layout.put(39, '-');
+	layout.put(51, '-');
+	layout.put(53, '-');
+	layout.put(3, 'w');
+	layout.put(66, 's');
+	return layout;
+}
+
+uint16_t secret(Game &game, char c) {
+	static constexpr Layout<7, 10> layout = secretLayout();
+	load(game, layout);
+	switch (c) {
+		case 'w':
+			return 59;
+		case 's':
+			return 10;
+		default:
+			return 31;
+	}
+}
+
+constexpr Layout<80, 40> bigRoomLayout() {
+	Layout<80, 40> layout;
+	layout.edgeWalls();
+	layout.put(40, 'w');
+	layout.put(1600, 'a');
+	layout.put(3160, 's');
+	layout.put(1679, 'd');
+	return layout;
+}
+
+uint16_t bigRoom(Game &game, char c) {
+	static constexpr Layout<80, 40> layout = bigRoomLayout();
+	load(game, layout);
+	switch(c) {
+		case 'w':
+			return 3080;
+		case 'a':
+			return 1678;
+		case 's':
+			return 120;
+		default:
+			return 1601;
+	}
+}
+
+constexpr Layout<80, 30> labyrinthLayout() {
+	Layout<80, 30> layout;
+	layout.edgeWalls();
+	layout.horizontalWall(402, 59);
+	layout.horizontalWall(724, 57);
+	layout.horizontalWall(883, 57);
+	layout.horizontalWall(1021, 17);
+	layout.horizontalWall(1121, 60);
+	layout.horizontalWall(1183, 16);
+	layout.horizontalWall(1246, 14);
+	layout.horizontalWall(1284, 21);
+	layout.horizontalWall(1309, 7);
+	layout.horizontalWall(1400, 38);
+	layout.horizontalWall(1444, 20);
+	layout.horizontalWall(1556, 43);
+	layout.horizontalWall(1714, 44);
+	layout.horizontalWall(1764, 15);
+	layout.horizontalWall(1872, 47);
+	layout.horizontalWall(1923, 8);
+	layout.horizontalWall(1932, 9);
+	layout.horizontalWall(2030, 48);
+	layout.horizontalWall(2085, 16);
+	layout.horizontalWall(2188, 51);
+	layout.verticalWall(91, 3);
+	layout.verticalWall(111, 3);
+	layout.verticalWall(118, 3);
+	layout.verticalWall(131, 3);
+	layout.verticalWall(141, 11);
+	layout.verticalWall(164, 3);
+	layout.verticalWall(179, 3);
+	layout.verticalWall(193, 3);
+	layout.verticalWall(205, 3);
+	layout.verticalWall(218, 3);
+	layout.verticalWall(482, 8);
+	layout.verticalWall(1202, 13);
+	layout.verticalWall(1202, 2);
+	layout.verticalWall(1305, 13);
+	layout.verticalWall(1307, 10);
+	layout.verticalWall(1526, 2);
+	layout.verticalWall(1530, 2);
+	layout.verticalWall(1534, 2);
+	layout.verticalWall(1538, 2);
+	layout.verticalWall(1541, 8);
+	layout.verticalWall(1608, 2);
+	layout.verticalWall(1612, 2);
+	layout.verticalWall(1616, 2);
+	layout.verticalWall(1624, 9);
+	layout.verticalWall(1629, 3); 
+	layout.leftDiag(1239, 13, '-');
+	layout.leftDiagWall(1262, 2);
+	layout.rightDiagWall(1389, 4);
+	layout.put(150, '-');
+	layout.put(235, '-');
+	layout.put(304, '-');
+	layout.put(470, '-');
+	layout.put(544, '-');
+	layout.put(634, '-');
+	layout.put(709, '-');
+	layout.put(793, '-');
+	layout.put(866, '-');
+	layout.put(1100, '-');
+	layout.put(1325, '-');
+	layout.put(1473, '-');
+	layout.put(1488, '-');
+	layout.put(1498, '-');
+	layout.put(1523, '-');
+	layout.put(1660, '-');
+	layout.put(1818, '-');
+	layout.put(1979, '-');
+	layout.put(301, ' ');
+	layout.put(701, ' ');
+	layout.put(1409, ' ');
+	layout.put(1422, ' ');
+	layout.put(1561, ' ');
+	layout.put(1575, ' ');
+	layout.put(1589, ' ');
+	layout.put(1739, ' ');
+	layout.put(1874, ' ');
+	layout.put(1888, ' ');
+	layout.put(1913, ' ');
+	layout.put(2044, ' ');
+	layout.put(2223, ' ');
+	layout.put(1271, 'w');
+	layout.put(1200, 'a');
+	layout.put(1043, 's');
+	layout.put(1041, 'd');
+	return layout;
+}
+
+uint16_t labyrinth(Game &game, char c) {
+	static constexpr Layout<80, 30> layout = labyrinthLayout();
+	load(game, layout);
+	switch(c) {
+		case 'w':
+			return 963;
+		case 'a':
+			return 961;
+		case 's':
+			return 1351;
+		default:
+			return 1201;
+	}
+}
+
+constexpr Layout<11, 10> blockRoomLayout() {
+	Layout<11, 10> layout;
+	layout.edgeWalls();
+	layout.horizontal(27, 4, '-');
+	layout.horizontal(49, 2, '-');
+	layout.horizontal(96, 2, 'B');
+	layout.vertical(14, 4, '-');
+	layout.vertical(41, 2, '-');
+	layout.vertical(74, 2, '-');
+	layout.vertical(58, 4, 'B');
+	layout.vertical(68, 3, 'B');
+	layout.put(62, 'B');
+	layout.put(70, 'B');
+	layout.put(64, '!');
+	layout.put(1, 'w');
+	layout.put(65, 'd');
+	return layout;
+}
+
+uint16_t blockRoom(Game &game, char c) {
+	static constexpr Layout<11, 10> layout = blockRoomLayout();
+	load(game, layout);
+	return 12;
+}
+
+constexpr Layout<10, 10> frontRoomLayout() {
+	Layout<10, 10> layout;
+	layout.edgeWalls();
+	layout.put(5, 'w');
+	layout.put(95, 's');
+	return layout;
+}
+
+uint16_t frontRoom(Game &game, char c) {
+	static constexpr Layout<10, 10> layout = frontRoomLayout();
+	load(game, layout);
+	if (c == 's') {
+		return 15;
+	}
+	put(game, 45, 'X');
+	return 45;
+}
+
+constexpr Layout<50, 40> knightsMoveLayout() {
+	Layout<50, 40> layout;
+	layout.edgeWalls();
+	layout.horizontal(1853, 34, '-');
+	for(uint16_t i = 52; i < 88; i++) {
+		layout.vertical(i, 37, '-');
+	}
+	layout.horizontal(904, 14, ' ');
+	layout.vertical(89, 2, '-');
+	layout.put(82, ' ');
+	layout.put(123, ' ');
+	layout.put(130, ' ');
+	layout.put(136, ' ');
+	layout.put(171, ' ');
+	layout.put(178, ' ');
+	layout.put(183, ' ');
+	layout.put(219, ' ');
+	layout.put(222, ' ');
+	layout.put(226, ' ');
+	layout.put(235, ' ');
+	layout.put(267, ' ');
+	layout.put(274, ' ');
+	layout.put(315, ' ');
+	layout.put(320, ' ');
+	layout.put(334, ' ');
+	layout.put(363, ' ');
+	layout.put(367, ' ');
+	layout.put(372, ' ');
+	layout.put(382, ' ');
+	layout.put(411, ' ');
+	layout.put(420, ' ');
+	layout.put(434, ' ');
+	layout.put(459, ' ');
+	layout.put(481, ' ');
+	layout.put(486, ' ');
+	layout.put(507, ' ');
+	layout.put(519, ' ');
+	layout.put(534, ' ');
+	layout.put(555, ' ');
+	layout.put(582, ' ');
+	layout.put(618, ' ');
+	layout.put(654, ' ');
+	layout.put(719, ' ');
+	layout.put(820, ' ');
+	layout.put(869, ' ');
+	layout.put(873, ' ');
+	layout.put(921, ' ');
+	layout.put(925, ' ');
+	layout.put(1024, ' ');
+	layout.put(1072, ' ');
+	layout.put(1120, ' ');
+	layout.put(1168, ' ');
+	layout.put(1165, ' ');
+	layout.put(1216, ' ');
+	layout.put(1264, ' ');
+	layout.put(1312, ' ');
+	layout.put(1360, ' ');
+	layout.put(1408, ' ');
+	layout.put(1456, ' ');	
+	layout.put(1504, ' ');
+	layout.put(1603, ' ');
+	layout.put(1903, '-');
+	layout.put(88, '+');
+	layout.put(138, '?');
+	layout.put(1970, 's');
+	return layout;
+}
+
+uint16_t knightsMove(Game &game, char c) {
+	static constexpr Layout<50, 40> layout = knightsMoveLayout();
+	load(game, layout);
+	addEntity(game, kindKnight, 1970, 0);
+	return 1920;
+}
+
+constexpr Layout<15, 15> powerGripLayout() {
+	Layout<15, 15> layout;
+	layout.edgeWalls();
+	layout.horizontal(69, 4, '-');
+	layout.horizontal(115, 4, '-');
+	layout.horizontal(159, 4, '-');
+	layout.vertical(22, 9, '-');
+	layout.vertical(24, 3, '-');
+	layout.horizontal(46, 5, 'B');
+	layout.horizontal(61, 5, 'B');
+	layout.horizontal(99, 2, 'B');
+	layout.horizontal(130, 4, 'B');
+	layout.vertical(21, 8, 'B');
+	layout.put(143, '-');
+	layout.put(84, 'B');
+	layout.put(86, 'B');
+	layout.put(128, 'B');
+	layout.put(42, '+');
+	layout.put(15, 'a');
+	return layout;
+}
+
+uint16_t powerGrip(Game &game, char c) {
+	static constexpr Layout<15, 15> layout = powerGripLayout();
+	load(game, layout);
+	return 202;
+}
+
+constexpr Layout<80, 40> finalRoomLayout() {
+	Layout<80, 40> layout;
+	layout.edgeWalls();
+	layout.horizontal(401, 78, '-');
+	layout.horizontal(481, 78, '-');
+	layout.horizontal(965, 74, '-');
+	layout.horizontal(1045, 74, '-');
+	layout.horizontal(1521, 77, '-');
+	layout.horizontal(1601, 78, '-');
+	layout.horizontal(2482, 77, '-');
+	layout.horizontal(2561, 78, '-');
+	layout.horizontal(1841, 78, 'B');
+	layout.horizontal(1921, 78, 'B');
+	layout.vertical(122, 5, '-');
+	layout.rightDiag(2840, 4, 'B');
+	layout.rightDiag(2920, 3, '-');
+	layout.rightDiag(3000, 2, '!');
+	layout.leftDiag(2919, 3, 'B');
+	layout.leftDiag(2999, 2, '-');
+	layout.put(3079, '!');
+	layout.put(696, 'B');
+	layout.put(1598, 'B');
+	layout.put(2481, 'B');
+	layout.put(754, '!');
+	layout.put(781, '!');
+	layout.put(1242, '!');
+	layout.put(1295, '!');
+	layout.put(321, '?');
+	layout.put(40, 'w');
+	layout.put(3080, 'o');
+	return layout;
+}
+
+uint16_t finalRoom(Game &game, char c) {
+	static constexpr Layout<80, 40> layout = finalRoomLayout();
+	load(game, layout);
+	addEntity(game, kindChange, 123, 0);
+	addEntity(game, kindChase, 1242, 0);
+	addEntity(game, kindChase, 754, 0);
+	addEntity(game, kindCopy, 781, 0);
+	addEntity(game, kindCopy, 1295, 0);
+	addEntity(game, kindKillHor, 1681, killForward);
+	addEntity(game, kindKillHor, 1681, (killWidth - 1) << killAlongShift);
+	addEntity(game, kindKillVert, 1681, killForward);
+	addEntity(game, kindKillVert, 1681, (killHeight - 1) << killAlongShift);
+	return 120;
+}
+
+// The plain 15x15 rooms only differ by which doors are walled up and what sits in them.
+constexpr Layout<15, 15> roomLayout() {
+	Layout<15, 15> layout;
+	layout.edgeWalls();
+	layout.put(7, 'w');
+	layout.put(105, 'a');
+	layout.put(217, 's');
+	layout.put(119, 'd');
+	return layout;
+}
+
+constexpr Layout<15, 15> leftLayout() {
+	Layout<15, 15> layout = roomLayout();
+	layout.put(105, '-');
+	return layout;
+}
+
+constexpr Layout<15, 15> rightLayout() {
+	Layout<15, 15> layout = roomLayout();
+	layout.put(119, '-');
+	return layout;
+}
+
+constexpr Layout<15, 15> topLayout() {
+	Layout<15, 15> layout = roomLayout();
+	layout.put(7, '-');
+	return layout;
+}
+
+constexpr Layout<15, 15> bottomLayout() {
+	Layout<15, 15> layout = roomLayout();
+	layout.put(217, '-');
+	return layout;
+}
+
+constexpr Layout<15, 15> topLeftLayout() {
+	Layout<15, 15> layout = topLayout();
+	layout.put(105, '-');
+	return layout;
+}
+
+constexpr Layout<15, 15> topRightLayout() {
+	Layout<15, 15> layout = topLayout();
+	layout.put(119, '-');
+	return layout;
+}
+
+constexpr Layout<15, 15> bottomLeftLayout() {
+	Layout<15, 15> layout = bottomLayout();
+	layout.put(105, '-');
+	return layout;
+}
+
+constexpr Layout<15, 15> bottomRightLayout() {
+	Layout<15, 15> layout = bottomLayout();
+	layout.put(119, '-');
+	return layout;
+}
+
+// Load one of the 15x15 rooms and pick where the player comes in.
+uint16_t squareRoom(Game &game, char c, const Layout<15, 15> &layout) {
+	load(game, layout);
+	switch(c) {
+		case 'w':
+		case 'W':
+			return 202;
+		case 'a':
+		case 'A':
+			return 118;
+		case 's':
+		case 'S':
+			return 22;
+		default:
+			return 106;
+	}
+}
+
+uint16_t room(Game &game, char c) {
+	static constexpr Layout<15, 15> layout = roomLayout();
+	return squareRoom(game, c, layout);
+}
+
+uint16_t left(Game &game, char c) {
+	static constexpr Layout<15, 15> layout = leftLayout();
+	return squareRoom(game, c, layout);
+}
+
+uint16_t right(Game &game, char c) {
+	static constexpr Layout<15, 15> layout = rightLayout();
+	return squareRoom(game, c, layout);
+}
+
+uint16_t top(Game &game, char c) {
+	static constexpr Layout<15, 15> layout = topLayout();
+	return squareRoom(game, c, layout);
+}
+
+uint16_t bottom(Game &game, char c) {
+	static constexpr Layout<15, 15> layout = bottomLayout();
+	return squareRoom(game, c, layout);
+}
+
+uint16_t topLeft(Game &game, char c) {
+	static constexpr Layout<15, 15> layout = topLeftLayout();
+	return squareRoom(game, c, layout);
+}
+
+uint16_t topRight(Game &game, char c) {
+	static constexpr Layout<15, 15> layout = topRightLayout();
+	return squareRoom(game, c, layout);
+}
+
+uint16_t bottomLeft(Game &game, char c) {
+	static constexpr Layout<15, 15> layout = bottomLeftLayout();
+	return squareRoom(game, c, layout);
+}
+
+uint16_t bottomRight(Game &game, char c) {
+	static constexpr Layout<15, 15> layout = bottomRightLayout();
+	return squareRoom(game, c, layout);
+}
+
+uint16_t cheese(Game &game, char c) {
+	uint16_t pos = room(game, c);
+	if ((game.flags & 0x10) == 0) {
+		put(game, 112, 'c');
+	}
+	return pos;
+}
+
+constexpr Layout<15, 15> downLayout() {
+	Layout<15, 15> layout = topLeftLayout();
+	layout.put(119, '-');
+	return layout;
+}
+
+uint16_t down(Game &game, char c) {
+	static constexpr Layout<15, 15> layout = downLayout();
+	return squareRoom(game, c, layout);
+}
+
+constexpr Layout<15, 15> upLayout() {
+	Layout<15, 15> layout = bottomRightLayout();
+	layout.put(105, 'A');
+	return layout;
+}
+
+uint16_t up(Game &game, char c) {
+	static constexpr Layout<15, 15> layout = upLayout();
+	return squareRoom(game, c, layout);
+}
+
+constexpr Layout<15, 15> checkersLayout() {
+	Layout<15, 15> layout = leftLayout();
+	layout.put(119, '-');
+	for (uint8_t y = 16; y < 200; y += 15) {
+		uint8_t x = y;
+		if ((x & 1) == 0) {
+			x++;
+		}
+		while (x < y + 13) {
+			layout.put(x, 'B');
+			x += 2;
+		}
+	}
+	return layout;
+}
+
+uint16_t checkers(Game &game, char c) {
+	static constexpr Layout<15, 15> layout = checkersLayout();
+	return squareRoom(game, c, layout);
+}
+
+constexpr Layout<11, 15> warpyLayout() {
+	Layout<11, 15> layout;
+	layout.edgeWalls();
+	layout.horizontal(25, 7, '-');
+	layout.horizontal(48, 3, '-');
+	layout.horizontal(61, 4, '-');
+	layout.horizontal(105, 4, '-');
+	layout.horizontal(126, 4, '-');
+	layout.vertical(13, 12, '-');
+	layout.vertical(59, 8, '-');
+	layout.vertical(83, 2, '-');
+	layout.put(1, 'w');
+	layout.put(5, 'W');
+	layout.put(159, 's');
+	layout.put(41, '*');
+	layout.put(85, '*');
+	return layout;
+}
+
+uint16_t warpy(Game &game, char c) {
+	static constexpr Layout<11, 15> layout = warpyLayout();
+	load(game, layout);
+	game.teleport[0] = 41;
+	game.teleport[1] = 85;
+	if (c == 'w') {
+		return 148;
+	}
+	if (c == 's') {
+		return 12;
+	}
+	return 16;
+}
+
+
+constexpr Layout<15, 15> vertLayout() {
+	Layout<15, 15> layout = leftLayout();
+	layout.put(119, '-');
+	return layout;
+}
+
+// Empty room with doors at the top and bottom.
+uint16_t vert(Game &game, char c) {
+	static constexpr Layout<15, 15> layout = vertLayout();
+	return squareRoom(game, c, layout);
+}
+
+
+constexpr Layout<15, 15> postWarpLayout() {
+	Layout<15, 15> layout = vertLayout();
+	layout.put(218, 'S');
+	return layout;
+}
+
+// Room between checkers and tele.
+uint16_t postWarp(Game &game, char c) {
+	static constexpr Layout<15, 15> layout = postWarpLayout();
+	uint16_t pos = squareRoom(game, c, layout);
+	if (c == 'W') {
+		pos++;
+	}
+	return pos;
+}
+
+
+constexpr Layout<15, 15> toKnightLayout() {
+	Layout<15, 15> layout = roomLayout();
+	layout.put(134, 'D');
+	return layout;
+}
+
+uint16_t toKnight(Game &game, char c) {
+	static constexpr Layout<15, 15> layout = toKnightLayout();
+	return squareRoom(game, c, layout);
+}
+
+constexpr Layout<15, 15> warpPointLayout() {
+	Layout<15, 15> layout = topRightLayout();
+	layout.put(217, '-');
+	layout.put(112, '+');
+	return layout;
+}
+
+uint16_t warpPoint(Game &game, char c) {
+	static constexpr Layout<15, 15> layout = warpPointLayout();
+	return squareRoom(game, c, layout);
+}
+
+constexpr Layout<80, 40> wallOdeathLayout() {
+	Layout<80, 40> layout;
+	layout.edgeWalls();
+	layout.put(3160, 's');
+	layout.horizontal(994, 14, 'B');
+	layout.horizontal(1440, 4, '-');
+	layout.horizontal(1765, 74, '-');
+	layout.vertical(108, 12, '-');
+	layout.vertical(132, 12, '-');
+	layout.vertical(1444, 5, '-');
+	layout.vertical(2918, 3, '-');
+	layout.vertical(2919, 3, '-');
+	layout.vertical(2921, 3, '-');
+	layout.vertical(2922, 3, '-');
+	layout.put(1602, '*');
+	layout.put(1677, '*');
+	return layout;
+}
+
+uint16_t wallOdeath(Game &game, char c) {
+	static constexpr Layout<80, 40> layout = wallOdeathLayout();
+	load(game, layout);
+	game.teleport[0] = 1602;
+	game.teleport[1] = 1677;
+	if (c == 'a') {
+		addEntity(game, kindDestroy, 3121, 0);
+		return 158;
+	}
+	return 3080;
+}
+
+
+constexpr Layout<18, 12> copyCatsLayout() {
+	Layout<18, 12> layout;
+	layout.edgeWalls();
+	layout.horizontal(38, 15, '-');
+	layout.horizontal(56, 15, '-');
+	layout.horizontal(91, 14, '-');
+	layout.horizontal(109, 14, '-');
+	layout.put(16, 'w');
+	layout.put(126, 'a');
+	layout.put(206, 's');
+	layout.put(134, '!');
+	return layout;
+}
+
+// This room has two enemies which copy your movements.
+uint16_t copyCats(Game &game, char c) {
+	static constexpr Layout<18, 12> layout = copyCatsLayout();
+	load(game, layout);
+	addEntity(game, kindCopy, 134, 0);
+	if (c == 's') {
+		return 34;
+	}
+	put(game, 34, '!');
+	addEntity(game, kindCopy, 34, 0);
+	if (c == 'w') {
+		return 188;
+	}
+	return 127;
+}
+
+
+constexpr Layout<10, 13> underLabLayout() {
+	Layout<10, 13> layout;
+	layout.edgeWalls();
+	layout.put(23, 'B');
+	layout.put(74, 'B');
+	layout.put(76, 'B');
+	layout.put(5, 'w');
+	layout.put(121, 's');
+	layout.put(128, 'S');
+	layout.horizontal(63, 2, '-');
+	layout.horizontal(66, 3, '-');
+	layout.horizontal(84, 3, '-');
+	layout.horizontal(107, 2, 'B');
+	layout.horizontal(33, 2, 'B');
+	layout.horizontal(36, 3, 'B');
+	layout.horizontal(44, 5, 'B');
+	layout.vertical(22, 10, '-');
+	return layout;
+}
+
+// This room is below the labyrinth room and has an optional puzzle.
+uint16_t underLab(Game &game, char c) {
+	static constexpr Layout<10, 13> layout = underLabLayout();
+	load(game, layout);
+	if (c == 'w') {
+		return 111;
+	}
+	if (c == 'W') {
+		return 118;
+	}
+	return 15;
+}
+
+
+constexpr Layout<17, 17> toStickyLayout() {
+	Layout<17, 17> layout;
+	layout.edgeWalls();
+	layout.put(95, '-');
+	layout.put(8, 'w');
+	layout.put(136, 'a');
+	layout.put(280, 's');
+	layout.horizontal(18, 7, 'B');
+	layout.horizontal(26, 7, 'B');
+	return layout;
+}
+
+// This room comes right before the room where you get the sticky.
+uint16_t toSticky(Game &game, char c) {
+	static constexpr Layout<17, 17> layout = toStickyLayout();
+	load(game, layout);
+	switch(c) {
+		case 'w':
+			return 263;
+		case 's':
+			return 25;
+		default:
+			return 137;
+	}
+}
+
+
+// This room is near the bottom of the map and has w, W, and d doors.
+constexpr Layout<15, 15> cornerLayout() {
+	Layout<15, 15> layout = bottomLeftLayout();
+	layout.put(8, 'W');
+	return layout;
+}
+
+uint16_t corner(Game &game, char c) {
+	static constexpr Layout<15, 15> layout = cornerLayout();
+	uint16_t pos = squareRoom(game, c, layout);
+	if (c == 'S') {
+		pos++;
+	}
+	return pos;
+}
+
+
+constexpr Layout<9, 15> shieldLayout() {
+	Layout<9, 15> layout;
+	layout.edgeWalls();
+	layout.put(24, 'B');
+	layout.put(113, 'B');
+	layout.put(4, 'w');
+	layout.put(130, 's');
+	for(uint16_t i = 37; i < 44; i++) {
+		layout.vertical(i, 7, '!');
+	}
+	return layout;
+}
+
+// This room requires you to shove a block through kill thingies.
+uint16_t shield(Game &game, char c) {
+	static constexpr Layout<9, 15> layout = shieldLayout();
+	load(game, layout);
+	if (c == 'w') {
+		return 121;
+	}
+	return 13;
+}
+
+
+constexpr Layout<45, 31> logoLayout() {
+	Layout<45, 31> layout;
+	layout.edgeWalls();
+	layout.put(514, 'B');
+	layout.put(608, 'B');
+	layout.put(748, 'B');
+	layout.put(779, 'B');
+	layout.put(963, 'B');
+	layout.put(973, 'B');
+	layout.put(1001, 'B');
+	layout.put(1090, 'B');
+	layout.put(1113, 'B');
+	layout.put(1144, 'B');
+	layout.put(1149, 'B');
+	layout.put(21, 'w');
+	layout.put(1371, 's');
+	layout.horizontal(289, 4, 'B');
+	layout.horizontal(333, 6, 'B');
+	layout.horizontal(378, 7, 'B');
+	layout.horizontal(425, 2, 'B');
+	layout.horizontal(428, 2, 'B');
+	layout.horizontal(470, 2, 'B');
+	layout.horizontal(650, 3, 'B');
+	layout.horizontal(1009, 2, 'B');
+	layout.horizontal(1100, 4, 'B');
+	layout.horizontal(1136, 3, 'B');
+	layout.horizontal(1155, 3, 'B');
+	layout.horizontal(1183, 6, 'B');
+	layout.horizontal(1195, 6, 'B');
+	layout.vertical(423, 4, 'B');
+	layout.vertical(778, 4, 'B');
+	layout.vertical(794, 4, 'B');
+	layout.vertical(822, 3, 'B');
+	layout.vertical(840, 3, 'B');
+	layout.vertical(841, 4, 'B');
+	layout.vertical(887, 4, 'B');
+	layout.leftDiag(557, 5, 'B');
+	layout.leftDiag(646, 3, 'B');
+	layout.leftDiag(956, 3, 'B');
+	layout.leftDiag(972, 5, 'B');
+	layout.rightDiag(474, 7, 'B');
+	layout.rightDiag(518, 2, 'B');
+	layout.rightDiag(519, 7, 'B');
+	layout.rightDiag(558, 2, 'B');
+	layout.rightDiag(914, 2, 'B');
+	layout.rightDiag(915, 6, 'B');
+	layout.rightDiag(916, 3, 'B');
+	layout.rightDiag(976, 2, 'B');
+	layout.rightDiag(977, 3, 'B');
+	return layout;
+}
+
+// This room looks like a penguin.
+uint16_t logo(Game &game, char c) {
+	static constexpr Layout<45, 31> layout = logoLayout();
+	load(game, layout);
+	if (c == 'w') {
+		return 1326;
+	}
+	return 66;
+}
+
+
+// Layout of the map. Each slot holds the function that builds that room.
+uint16_t (*const worldMap[121])(Game&, char) = {	nullptr,	nullptr,	nullptr,	topLeft,	top,	top,	top,	top,	top,		topRight,		nullptr,
+																					nullptr,	nullptr,	nullptr,	vert,		left,	room,	room,	room,	room,		right,			nullptr,
+																					nullptr,	wallOdeath,	warpPoint,	vert,		left,	room,	room,	room,	room,		right,			nullptr,
+																					nullptr,	bottomLeft,	copyCats,	tele,		left,	room,	room,	cheese,	room,		right,			nullptr,
+																					down,		powerGrip,	logo,		postWarp,	left,	room,	room,	room,	room,		right,			nullptr,
+																					bottomLeft,	toSticky,	mudRoom,	checkers,	left,	room,	room,	room,	room,		right,			nullptr,
+																					nullptr,	blocks,		hall,		warpy,		left,	room,	room,	room,	room,		right,			nullptr,
+																					nullptr,	prison,		bigRoom,	labyrinth,	room,	room,	room,	room,	room,		right,			nullptr,
+																					nullptr,	blockRoom,	frontRoom,	underLab,	left,	room,	room,	room,	room,		right,			knightsMove,
+																					nullptr,	nullptr,	finalRoom,	shield,		left,	room,	room,	room,	toKnight,	right,			up,
+																					nullptr,	nullptr,	nullptr,	corner,		bottom,	bottom,	bottom,	bottom,	bottom,		bottomRight,	nullptr};
+
+
+// A few constants describing the map. Rooms of worldMap keep their index as their id in the world.
+const uint8_t mapWidth = 11;		// Rooms per row of worldMap.
+const uint32_t startRoom = 90;		// Where the player starts.
+const uint32_t cage = 78;			// The prison, which is replaced by secret once its button is hit.
+const uint32_t warpRoom = 24;		// Where the warp point is.
+const uint32_t knightRoom = 98;		// Where the knight's move is.
+const uint32_t grabRoom = 45;		// Where the sticky is.
+const uint32_t secretRoom = 121;	// The secret room's id. No door leads there; it takes the prison's place.
+
+
+// What the built-in rooms are called when they are exported to room files.
+const struct {
+	const char *name;
+	uint16_t (*initializer)(Game&, char);
+} roomNames[] = {{"mudRoom", mudRoom}, {"blocks", blocks}, {"hall", hall}, {"tele", tele}, {"prison", prison}, {"secret", secret},
+		{"bigRoom", bigRoom}, {"labyrinth", labyrinth}, {"blockRoom", blockRoom}, {"frontRoom", frontRoom}, {"knightsMove", knightsMove},
+		{"powerGrip", powerGrip}, {"finalRoom", finalRoom}, {"room", room}, {"left", left}, {"right", right}, {"top", top},
+		{"bottom", bottom}, {"topLeft", topLeft}, {"topRight", topRight}, {"bottomLeft", bottomLeft}, {"bottomRight", bottomRight},
+		{"cheese", cheese}, {"down", down}, {"up", up}, {"checkers", checkers}, {"warpy", warpy}, {"vert", vert}, {"postWarp", postWarp},
+		{"toKnight", toKnight}, {"warpPoint", warpPoint}, {"wallOdeath", wallOdeath}, {"copyCats", copyCats}, {"underLab", underLab},
+		{"toSticky", toSticky}, {"corner", corner}, {"shield", shield}, {"logo", logo}};
+
+
+// Things step() reports back to whoever is running the game.
+const uint16_t eventRoom = 0x01;	// A new room was entered or the current one was reset.
+const uint16_t eventDied = 0x02;	// The player ran into a '!'.
+const uint16_t eventWon = 0x04;		// The player found the bagel.
+const uint16_t eventQuit = 0x08;	// The player pressed 't'.
+const uint16_t eventWarp = 0x10;	// The player picked up the warp point.
+const uint16_t eventKnight = 0x20;	// The player picked up the knight's move.
+const uint16_t eventSticky = 0x40;	// The player picked up the sticky.
+const uint16_t eventCheese = 0x80;	// The player picked up the cream cheese.
+
+
+// The world is a graph of places: a room and where each of its doors leads. Places are
+// found by id in a hash table, so ids can be anything and memory only grows with the
+// number of places, not with how far apart their ids are.
+const uint32_t noRoom = 0xFFFFFFFF;		// Where a door that leads nowhere goes. Never an id.
+const char doorGlyphs[] = "wWaAsSdD";	// The doors, in the order of Place::doors.
+
+struct Place {
+	uint32_t id;		// noRoom if this entry of the table is empty.
+	uint16_t (*initializer)(Game&, char);	// Builds the room, nullptr if only the room atlas has it.
+	const uint16_t *variants;	// Where the room atlas keeps the room, nullptr if it doesn't.
+	uint32_t doors[8];	// Where each of doorGlyphs leads.
+};
+
+std::vector<Place> world;	// Hash table of every place, always a power of two long. Only changes before play starts.
+uint32_t worldCount;		// Places in world.
+
+
+// The entry of world that holds id, or the empty one it would go in.
+Place &placeEntry(std::vector<Place> &table, uint32_t id) {
+	uint32_t mask = table.size() - 1;
+	uint32_t i = id * 0x9E3779B1;
+	for (i ^= i >> 16; table[i & mask].id != id && table[i & mask].id != noRoom; i++);
+	return table[i & mask];
+}
+
+
+// Find place id. Returns nullptr if the world has no such place.
+const Place *findPlace(uint32_t id) {
+	if (world.empty() || id == noRoom) {
+		return nullptr;
+	}
+	const Place &place = placeEntry(world, id);
+	return place.id == id ? &place : nullptr;
+}
+
+
+// Find place id, adding it with no room and no doors if it isn't there yet.
+// The reference is only good until the next place is added.
+Place &addPlace(uint32_t id) {
+	if ((worldCount + 1) * 4 > world.size() * 3) {
+		std::vector<Place> table(world.empty() ? 256 : world.size() * 2);
+		for (Place &entry : table) {
+			entry.id = noRoom;
+		}
+		for (const Place &place : world) {
+			if (place.id != noRoom) {
+				placeEntry(table, place.id) = place;
+			}
+		}
+		world.swap(table);
+	}
+	Place &place = placeEntry(world, id);
+	if (place.id == noRoom) {
+		place.id = id;
+		place.initializer = nullptr;
+		place.variants = nullptr;
+		for (uint32_t &door : place.doors) {
+			door = noRoom;
+		}
+		worldCount++;
+	}
+	return place;
+}
+
+
+// Add the rooms of worldMap to the world. A door leads to the next room in its direction,
+// or two rooms over for capitals, like walking off the edge of the room would suggest.
+void buildWorld() {
+	const int8_t offsets[8] = {-mapWidth, -2 * mapWidth, -1, -2, mapWidth, 2 * mapWidth, 1, 2};
+	for (int16_t i = 0; i < 121; i++) {
+		if (worldMap[i] == nullptr) {
+			continue;
+		}
+		Place &place = addPlace(i);
+		place.initializer = worldMap[i];
+		for (uint8_t door = 0; door < 8; door++) {
+			int16_t next = i + offsets[door];
+			if (next >= 0 && next < 121 && worldMap[next] != nullptr) {
+				place.doors[door] = next;
+			}
+		}
+	}
+	addPlace(secretRoom).initializer = secret;
+}
+
+
+// A room as its initializer left it, so building it again is a copy.
+struct Snapshot {
+	uint16_t (*initializer)(Game&, char);	// Room this is a snapshot of, nullptr if the entry is empty.
+	char entrance;		// Door the player came in through.
+	uint8_t flags;		// Flag bits the room was built with, masked by roomFlags.
+	uint8_t width;
+	uint8_t height;
+	uint16_t position;	// Where the player starts.
+	Entities entities;
+	uint32_t teleport[2];
+	uint64_t used;		// snapshotClock when it was last used, to find the one to drop.
+	std::shared_ptr<const std::vector<uint8_t>> terrain;	// Packed terrain tiles, row by row.
+	std::vector<Piece> pieces;
+};
+
+
+// Built rooms are kept in a small cache that drops the least recently used one when it's full.
+const uint8_t roomFlags = 0x10;		// Flag bits some initializers look at (cheese checks for the cream cheese).
+const uint8_t snapshotCount = 64;	// Rooms the cache holds.
+Snapshot snapshots[snapshotCount];
+uint64_t snapshotClock;				// Counts uses of the cache.
+std::mutex snapshotLock;			// Guards the cache and the prefetcher, which the server's threads share.
+uint32_t roomsCached;				// Rooms entered straight from the cache.
+uint32_t roomsBuilt;				// Rooms that had to be built while the player waited.
+uint32_t roomsPrefetched;			// Rooms the prefetcher built.
+
+
+// Find the snapshot of initializer's room for a player coming in through door c. Returns nullptr if it isn't cached.
+// snapshotLock has to be held.
+Snapshot *findSnapshot(uint16_t (*initializer)(Game&, char), char c, uint8_t flags) {
+	for (Snapshot &snapshot : snapshots) {
+		if (snapshot.initializer == initializer && snapshot.entrance == c && snapshot.flags == flags) {
+			return &snapshot;
+		}
+	}
+	return nullptr;
+}
+
+
+// Build initializer's room into built. This is the slow part, so snapshotLock shouldn't be held.
+void buildSnapshot(Snapshot &built, uint16_t (*initializer)(Game&, char), char c, uint8_t flags) {
+
+	// Build the room in a blank game so the snapshot only holds what the initializer set up.
+	Game *scratch = new Game();
+	scratch->flags = flags;
+	built.initializer = initializer;
+	built.entrance = c;
+	built.flags = flags;
+	built.position = initializer(*scratch, c);
+	built.width = scratch->width;
+	built.height = scratch->height;
+	built.entities = scratch->entities;
+	memcpy(built.teleport, scratch->teleport, sizeof(built.teleport));
+	std::shared_ptr<std::vector<uint8_t>> terrain = std::make_shared<std::vector<uint8_t>>();
+	packBoard(*scratch, *terrain, built.pieces);
+	built.terrain = terrain;
+	delete scratch;
+}
+
+
+// Put built in the cache in place of the least recently used room, unless another thread got there first.
+// snapshotLock has to be held.
+Snapshot &storeSnapshot(const Snapshot &built) {
+	Snapshot *stored = findSnapshot(built.initializer, built.entrance, built.flags);
+	if (stored != nullptr) {
+		return *stored;
+	}
+	stored = snapshots;
+	for (Snapshot &snapshot : snapshots) {
+		if (snapshot.used < stored->used) {
+			stored = &snapshot;
+		}
+	}
+	*stored = built;
+	stored->used = ++snapshotClock;
+	return *stored;
+}
+
+
+// The room atlas holds rooms compiled from room files (see compileRooms), so they can be
+// changed without rebuilding the game. It is mapped in whole, and a room's tiles are used
+// straight from the mapping until the game writes to them. Every field is little-endian
+// and naturally aligned.
+const uint8_t atlasVariants = 18;			// Per place: each entrance, without and then with the roomFlags bits.
+const char atlasDoors[] = ".wWaAsSdD";		// Entrances in the order of the variants. '.' is the start of a game.
+
+struct AtlasHeader {
+	char magic[8];			// "PZLATLS6"
+	uint32_t placeCount;	// AtlasPlaces following the header.
+	uint32_t roomCount;		// AtlasRooms following the places.
+	uint32_t tableSize;		// Entries of the tile table following the rooms: 1 + index of a tile, or 0 for a blank one.
+	uint32_t pieceCount;	// Pieces following the table.
+	uint32_t entityCount;	// AtlasEntities following the pieces.
+	uint32_t tileCount;		// Packed terrain tiles following the entities, terrainBytes each.
+};
+
+struct AtlasPlace {
+	uint32_t id;
+	uint32_t doors[8];		// Where each of doorGlyphs leads. noRoom leaves a built-in door as it is.
+	uint16_t variants[atlasVariants];	// 1 + index of the AtlasRoom to use for each variant.
+};
+
+struct AtlasRoom {
+	uint32_t tiles;		// Where the room's terrain tiles start in the tile table. They go row by row.
+	uint32_t pieces;	// Where the room's pieces start.
+	uint32_t pieceCount;
+	uint32_t entities;	// Where the room's entities start. They are sorted by kind.
+	uint32_t entityCount;
+	uint32_t position;	// Where the player starts.
+	uint16_t width;
+	uint16_t height;
+	uint32_t teleport[2];
+};
+
+struct AtlasEntity {
+	uint32_t position;
+	uint32_t state;
+	uint8_t kind;
+	uint8_t padding[3];
+};
+
+static_assert(sizeof(AtlasHeader) == 32 && sizeof(AtlasPlace) == 72 && sizeof(AtlasRoom) == 36 && sizeof(AtlasEntity) == 12 &&
+		sizeof(Piece) == 8, "The atlas layout must not depend on the compiler.");
+
+const AtlasRoom *atlasRooms;	// Mapped in by loadAtlas.
+const uint32_t *atlasTable;
+const Piece *atlasPieces;
+const AtlasEntity *atlasEntities;
+const uint8_t *atlasTiles;
+
+
+// How many tiles a width by height room is made of.
+uint32_t tileCount(uint16_t width, uint16_t height) {
+	return (uint32_t) ((width + tileSide - 1) >> tileShift) * ((height + tileSide - 1) >> tileShift);
+}
+
+
+// Which of a slot's variants is used for a player coming in through door c with flags.
+int atlasVariant(char c, uint8_t flags) {
+	const char *door = c == ' ' ? atlasDoors : strchr(atlasDoors + 1, c);
+	if (c == '\0' || door == nullptr) {
+		return -1;
+	}
+	return (door - atlasDoors) * 2 + ((flags & roomFlags) != 0);
+}
+
+
+// Whether every cell an entity of kind at position with state works on is in a room width by height.
+bool entityFits(uint8_t kind, uint32_t position, uint32_t state, uint16_t width, uint16_t height) {
+	uint64_t area = (uint64_t) width * height;
+	switch (kind) {
+		case kindChange:
+			return position + 4 * (uint64_t) width < area;
+		case kindButton:
+			return position + (uint64_t) 8 < area;
+		case kindReveal:
+			return position + (uint64_t) 84 < area;
+		case kindKnight:
+			return position >= 120 && position < area;
+		case kindDanger:
+			return position + (uint64_t) 1 < area && state <= 1;
+		case kindDestroy:
+			return position >= width && position < area && position % width + 1 < width && state <= position / width + 3;
+		case kindKillHor:
+		case kindKillVert:
+			if (position % width + killWidth > width || position + killWidth - 1 + (killHeight - 1) * (uint64_t) width >= area) {
+				return false;
+			}
+			return state >> killAlongShift < (kind == kindKillHor ? killWidth : killHeight);
+		case kindChase:
+		case kindCopy:
+			return position < area;
+		default:
+			return true;
+	}
+}
+
+
+// Map the room atlas at path in and add its places to the world. Everything in it is checked
+// here, so entering a room doesn't have to.
+bool loadAtlas(const char *path) {
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		perror(path);
+		return false;
+	}
+	struct stat info;
+	void *mapped = MAP_FAILED;
+	if (fstat(fd, &info) == 0 && (size_t) info.st_size >= sizeof(AtlasHeader)) {
+		mapped = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	}
+	close(fd);
+	if (mapped == MAP_FAILED) {
+		fprintf(stderr, "%s: not a room atlas\n", path);
+		return false;
+	}
+	const AtlasHeader *header = (const AtlasHeader*) mapped;
+	const AtlasPlace *places = (const AtlasPlace*) (header + 1);
+	const AtlasRoom *rooms = (const AtlasRoom*) (places + header->placeCount);
+	const uint32_t *table = (const uint32_t*) (rooms + header->roomCount);
+	const Piece *pieces = (const Piece*) (table + header->tableSize);
+	const AtlasEntity *entities = (const AtlasEntity*) (pieces + header->pieceCount);
+	bool valid = memcmp(header->magic, "PZLATLS6", 8) == 0 && sizeof(AtlasHeader) + (uint64_t) header->placeCount * sizeof(AtlasPlace) +
+			(uint64_t) header->roomCount * sizeof(AtlasRoom) + (uint64_t) header->tableSize * 4 + (uint64_t) header->pieceCount * sizeof(Piece) +
+			(uint64_t) header->entityCount * sizeof(AtlasEntity) + (uint64_t) header->tileCount * terrainBytes <= (uint64_t) info.st_size;
+	for (uint32_t i = 0; valid && i < header->placeCount; i++) {
+		valid = places[i].id != noRoom;
+		for (uint8_t j = 0; valid && j < atlasVariants; j++) {
+			valid = places[i].variants[j] != 0 && places[i].variants[j] <= header->roomCount;
+		}
+	}
+	for (uint32_t i = 0; valid && i < header->roomCount; i++) {
+		const AtlasRoom &room = rooms[i];
+		valid = room.width != 0 && room.width <= maxSide && room.height != 0 && room.height <= maxSide &&
+				room.position < (uint32_t) room.width * room.height &&
+				room.teleport[0] < (uint32_t) room.width * room.height && room.teleport[1] < (uint32_t) room.width * room.height &&
+				(uint64_t) room.tiles + tileCount(room.width, room.height) <= header->tableSize &&
+				(uint64_t) room.pieces + room.pieceCount <= header->pieceCount &&
+				(uint64_t) room.entities + room.entityCount <= header->entityCount;
+
+		// Every cell an entity works on has to be in the room.
+		for (uint32_t j = 0; valid && j < room.entityCount; j++) {
+			const AtlasEntity &entity = entities[room.entities + j];
+			valid = entity.kind < kindCount && (j == 0 || entity.kind >= entities[room.entities + j - 1].kind) &&
+					entityFits(entity.kind, entity.position, entity.state, room.width, room.height);
+		}
+		for (uint32_t j = 0; valid && j < room.pieceCount; j++) {
+			valid = pieces[room.pieces + j].position < (uint32_t) room.width * room.height;
+		}
+	}
+	for (uint32_t i = 0; valid && i < header->tableSize; i++) {
+		valid = table[i] <= header->tileCount;
+	}
+	if (!valid) {
+		fprintf(stderr, "%s: not a room atlas\n", path);
+		munmap(mapped, info.st_size);
+		return false;
+	}
+	atlasRooms = rooms;
+	atlasTable = table;
+	atlasPieces = pieces;
+	atlasEntities = entities;
+	atlasTiles = (const uint8_t*) (entities + header->entityCount);
+	for (uint32_t i = 0; i < header->placeCount; i++) {
+		Place &place = addPlace(places[i].id);
+		place.variants = places[i].variants;
+		for (uint8_t j = 0; j < 8; j++) {
+			if (places[i].doors[j] != noRoom) {
+				place.doors[j] = places[i].doors[j];
+			}
+		}
+	}
+
+	// Doors can only be checked once every place is in.
+	for (uint32_t i = 0; i < header->placeCount; i++) {
+		for (uint32_t door : places[i].doors) {
+			if (door != noRoom && findPlace(door) == nullptr) {
+				fprintf(stderr, "%s: place %u has a door to %u, which isn't anywhere\n", path, places[i].id, door);
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+
+// Replace entities with count atlas entities, which are sorted by kind.
+void loadEntities(Entities &entities, const AtlasEntity *atlas, uint32_t count) {
+	entities.position.resize(count);
+	entities.state.resize(count);
+	memset(entities.first, 0, sizeof(entities.first));
+	for (uint32_t i = 0; i < count; i++) {
+		entities.position[i] = atlas[i].position;
+		entities.state[i] = atlas[i].state;
+		entities.first[atlas[i].kind + 1]++;
+	}
+	for (uint8_t kind = 1; kind <= kindCount; kind++) {
+		entities.first[kind] += entities.first[kind - 1];
+	}
+}
+
+
+// A room for the prefetcher to get ready.
+struct Prefetch {
+	const Place *place;
+	char entrance;
+	uint8_t flags;
+};
+
+const uint8_t prefetchSize = 32;	// Requests the prefetcher can have waiting. Older ones are dropped.
+Prefetch prefetches[prefetchSize];	// Ring buffer of requests, guarded by snapshotLock.
+uint32_t prefetchesRead;
+uint32_t prefetchesWritten;
+std::condition_variable prefetchReady;	// Signalled when a request is added or the prefetcher has to stop.
+std::thread prefetchThread;
+bool prefetcherStopping;
+
+
+// Get requested rooms ready on a thread of their own, so players don't wait for them.
+// Built rooms go into the cache and atlas rooms have their pages read in.
+void prefetcher() {
+	std::unique_lock<std::mutex> lock(snapshotLock);
+	while (true) {
+		prefetchReady.wait(lock, [] {
+			return prefetchesRead != prefetchesWritten || prefetcherStopping;
+		});
+		if (prefetcherStopping) {
+			return;
+		}
+		Prefetch next = prefetches[prefetchesRead++ % prefetchSize];
+		int variant = atlasVariant(next.entrance, next.flags);
+		if (next.place->variants != nullptr && variant >= 0) {
+			const AtlasRoom &room = atlasRooms[next.place->variants[variant] - 1];
+			lock.unlock();
+			volatile char sink = 0;
+			uint32_t count = tileCount(room.width, room.height);
+			for (uint32_t i = 0; i < count; i++) {
+				uint32_t tile = atlasTable[room.tiles + i];
+				if (tile != 0) {
+					const uint8_t *terrain = atlasTiles + (tile - 1) * (size_t) terrainBytes;
+					sink += terrain[0] + terrain[terrainBytes - 1];
+				}
+			}
+			lock.lock();
+			continue;
+		}
+		if (findSnapshot(next.place->initializer, next.entrance, next.flags) != nullptr) {
+			continue;
+		}
+		lock.unlock();
+		Snapshot *built = new Snapshot();
+		buildSnapshot(*built, next.place->initializer, next.entrance, next.flags);
+		lock.lock();
+		storeSnapshot(*built);
+		roomsPrefetched++;
+		delete built;
+	}
+}
+
+
+// Stop the prefetcher on the way out. A thread still waiting on prefetchReady would keep it from being destroyed.
+void stopPrefetcher() {
+	{
+		std::lock_guard<std::mutex> lock(snapshotLock);
+		prefetcherStopping = true;
+	}
+	prefetchReady.notify_one();
+	prefetchThread.join();
+}
+
+
+// Have the prefetcher get the rooms behind place's doors ready for a player with flags.
+// Rooms that are already cached are left alone, so the prefetcher is only woken when there is work.
+void prefetch(const Place *place, uint8_t flags) {
+	std::lock_guard<std::mutex> lock(snapshotLock);
+	if (!prefetchThread.joinable()) {
+		prefetchThread = std::thread(prefetcher);
+		atexit(stopPrefetcher);
+	}
+	flags &= roomFlags;
+	uint32_t written = prefetchesWritten;
+	for (uint8_t door = 0; door < 8; door++) {
+		if (place->doors[door] == noRoom) {
+			continue;
+		}
+		const Place *next = findPlace(place->doors[door] == cage && (flags & 1) == 1 ? secretRoom : place->doors[door]);
+		if (next->variants == nullptr && findSnapshot(next->initializer, doorGlyphs[door], flags) != nullptr) {
+			continue;
+		}
+		if (prefetchesWritten - prefetchesRead == prefetchSize) {
+			prefetchesRead++;
+		}
+		Prefetch &request = prefetches[prefetchesWritten++ % prefetchSize];
+		request.place = next;
+		request.entrance = doorGlyphs[door];
+		request.flags = flags;
+	}
+	if (prefetchesWritten != written) {
+		prefetchReady.notify_one();
+	}
+}
+
+
+// Build the room of place id for a player coming in through door c. Returns where the player starts.
+uint32_t enter(Game &game, uint32_t id, char c) {
+	const Place *place = findPlace(id == cage && (game.flags & 1) == 1 ? secretRoom : id);
+	int variant = atlasVariant(c, game.flags);
+	if (place->variants != nullptr && variant >= 0) {
+		const AtlasRoom &room = atlasRooms[place->variants[variant] - 1];
+		resizeBoard(game, room.width, room.height);
+		for (uint32_t i = 0; i < game.terrain.size(); i++) {
+			uint32_t tile = atlasTable[room.tiles + i];
+			if (tile != 0) {
+				game.terrain[i] = atlasTiles + (tile - 1) * (size_t) terrainBytes;
+			}
+		}
+		placePieces(game, atlasPieces + room.pieces, room.pieceCount);
+		loadEntities(game.entities, atlasEntities + room.entities, room.entityCount);
+		scheduleEntities(game);
+		memcpy(game.teleport, room.teleport, sizeof(game.teleport));
+		touchAll(game);
+		prefetch(findPlace(id), game.flags);
+		return room.position;
+	}
+
+	// The room is copied out with the lock held, so nothing can replace it halfway through.
+	uint8_t flags = game.flags & roomFlags;
+	std::unique_lock<std::mutex> lock(snapshotLock);
+	Snapshot *room = findSnapshot(place->initializer, c, flags);
+	if (room == nullptr) {
+		lock.unlock();
+		Snapshot *built = new Snapshot();
+		buildSnapshot(*built, place->initializer, c, flags);
+		lock.lock();
+		room = &storeSnapshot(*built);
+		roomsBuilt++;
+		delete built;
+	}
+	else {
+		roomsCached++;
+	}
+	room->used = ++snapshotClock;
+	resizeBoard(game, room->width, room->height);
+	game.terrainOwner = room->terrain;
+	for (uint32_t i = 0; i < game.terrain.size(); i++) {
+		game.terrain[i] = room->terrain->data() + i * terrainBytes;
+	}
+	placePieces(game, room->pieces.data(), room->pieces.size());
+	game.entities = room->entities;
+	memcpy(game.teleport, room->teleport, sizeof(game.teleport));
+	uint32_t position = room->position;
+	lock.unlock();
+	scheduleEntities(game);
+	touchAll(game);
+	prefetch(findPlace(id), game.flags);
+	return position;
+}
+
+
+// Set up a fresh game in its first room. cheat starts the player with every power.
+void newGame(Game &game, bool cheat) {
+	game = Game();
+	game.flags = cheat ? 14 : 0;
+	game.input = ' ';
+	game.warp = 0;
+	game.moves = 0;
+	game.roomNum = startRoom;
+	game.entrance = 'w';
+	game.position = enter(game, game.roomNum, ' ');
+}
+
+
+// What step() is given for a turn that passes without a key, in real-time mode. It isn't counted as a move.
+const char noKey = '\0';
+
+
+// Whether no entity is due on any turn to come, so turns without keys would change nothing.
+bool entitiesIdle(const Game &game) {
+	return !game.schedule.fired && game.schedule.next.empty();
+}
+
+
+// Advance the game by one turn in response to key. Returns the events that happened.
+// This never touches the terminal, so it can run without one.
+uint16_t step(Game &game, char key) {
+	uint16_t events = 0;
+	uint32_t block = 0;
+	uint32_t door;
+	uint32_t position = game.position;
+	game.input = key;
+	game.moves += key != noKey;
+	uint32_t newPosition = position;
+	switch (key) {
+		case 'w':
+			block = position + game.width;
+			newPosition -= game.width;
+			break;
+		case 'a':
+			block = position + 1;
+			newPosition--;
+			break;
+		case 's':
+			block = position - game.width;
+			newPosition += game.width;
+			break;
+		case 'd':
+			block = position - 1;
+			newPosition++;
+			break;
+		case 'r':
+			clear(game, game.warp, '@');
+			game.warp = position;
+			break;
+		case 'f':
+			if ((game.flags & 2) == 2 && game.warp != 0) {
+				newPosition = game.warp;
+			}
+			break;
+		case 'e':
+			if ((game.flags & 0x28) == 0x28) {
+				game.flags &= 0xDF;
+			}
+			else if ((game.flags & 8) == 8) {
+				game.flags |= 0x20;
+			}
+			break;
+		case 'x':
+			newPosition = enter(game, game.roomNum, game.entrance);
+			events |= eventRoom;
+	}
+	if ((game.flags & 4) == 4) {
+		moveKnight(game, position, &newPosition);
+	}
+	updateEntities(game, position);
+	uint8_t ahead = traits(game, newPosition);
+	if ((ahead & traitSolid) != 0) {
+		newPosition = position;
+	}
+	else if ((ahead & traitPushable) != 0) {
+		uint32_t blockPos;
+		switch (key) {
+			case 'w':
+				blockPos = newPosition - game.width;
+				break;
+			case 'a':
+				blockPos = newPosition - 1;
+				break;
+			case 's':
+				blockPos = newPosition + game.width;
+				break;
+			case 'd':
+				blockPos = newPosition + 1;
+				break;
+			default:
+				blockPos = newPosition;
+				newPosition = position;
+		}
+		if ((traits(game, blockPos) & stopsBlocks) != 0) {
+			newPosition = position;
+		}
+		else {
+			put(game, blockPos, 'B');
+		}
+	}
+	char landed = cell(game, newPosition);
+	ahead = cellTraits.of[(uint8_t) landed];
+	if ((ahead & traitDoor) != 0) {
+		door = findPlace(game.roomNum)->doors[strchr(doorGlyphs, landed) - doorGlyphs];
+		if (door == noRoom) {
+			newPosition = position;
+		}
+		else {
+			game.roomNum = door;
+			game.entrance = landed;
+			newPosition = enter(game, game.roomNum, game.entrance);
+			events |= eventRoom;
+			game.warp = 0;
+		}
+	}
+	else if ((ahead & traitLethal) != 0) {
+		return events | eventDied;
+	}
+	else if ((ahead & traitTeleporter) != 0) {
+		if (game.teleport[0] == newPosition) {
+			newPosition = game.teleport[1];
+		}
+		else {
+			newPosition = game.teleport[0];
+		}
+		switch (key) {
+			case 'w':
+				newPosition -=  game.width;
+				break;
+			case 'a':
+				newPosition--;
+				break;
+			case 's':
+				newPosition += game.width;
+				break;
+			case 'd':
+				newPosition++;
+				break;
+			default:
+				newPosition = position;
+		}
+
+		// A room with a '*' but no teleport pair could send the player out of it.
+		if (newPosition >= (uint32_t) game.width * game.height) {
+			newPosition = position;
+		}
+	}
+	else if ((ahead & traitPickup) != 0) {
+		switch (landed) {
+			case '?':
+				for (uint32_t i = game.entities.first[kindChange]; i < game.entities.first[signalKinds]; i++) {
+					game.entities.state[i] = 1;	// Tell whatever waits for the '?' that it was hit.
+				}
+				game.schedule.fired = true;
+				break;
+			case '+':
+				if (game.roomNum == warpRoom) {
+					game.flags |= 2;
+					game.warp = 0;
+					game.flags &= 0xDF;
+					events |= eventWarp;
+				}
+				else if (game.roomNum == knightRoom) {
+					game.flags |= 4;
+					clear(game, game.warp, '@');
+					game.warp = 0;
+					game.flags &= 0xDF;
+					events |= eventKnight;
+				}
+				else {
+					game.flags |= 8;
+					game.flags &= 0xDF;
+					clear(game, game.warp, '@');
+					game.warp = 0;
+					events |= eventSticky;
+				}
+				break;
+			case 'c':
+				game.flags |= 0x10;
+				events |= eventCheese;
+				break;
+			case 'o':
+				return events | eventWon;
+		}
+	}
+	if ((game.flags & 0x20) == 0x20 && position != newPosition && (traits(game, block) & traitPushable) != 0) {
+		put(game, block, ' ');
+		put(game, position, 'B');
+	}
+	else {
+		clear(game, position, 'X');
+	}
+	game.position = newPosition;
+	if ((game.flags & 2) == 2 && cell(game, game.warp) == ' ') {
+		put(game, game.warp, '@');
+	}
+	put(game, game.position, 'X');
+	if (key == 't') {
+		events |= eventQuit;
+	}
+	return events;
+}
+
+
+// Shown before the game starts.
+const char welcome[] = "\n\n\nWelcome to puzzle-land.\nYour objective is to find a circular item (It looks like the letter 'o').\nIt shouldn't be far from your starting location.\nwasd - move\nt - close\nx - reset room\nAny other key - wait\nPress enter to continue.\n";
+
+
+// What to tell the player about a pickup in events, or nullptr if there wasn't one.
+const char *pickupMessage(uint16_t events) {
+	if ((events & eventWarp) != 0) {
+		return "You found the warp point! Good for you!\nPress 'r' and 'f' to use it.\nPress any key to continue.\n";
+	}
+	if ((events & eventKnight) != 0) {
+		return "You found the knight's move! Nice.\nUse it with y, u, i, o, h, j, k, and l.\nPress any key to continue.\n";
+	}
+	if ((events & eventSticky) != 0) {
+		return "You found the sticky.\nPress e to use it.\nPress any key to continue.\n";
+	}
+	if ((events & eventCheese) != 0) {
+		return "You found some moldy cream cheese.\nMaybe if you cut the moldy parts off it might still be useful for something.\nPress any key to continue.\n";
+	}
+	return nullptr;
+}
+
+
+// Write what to tell the player when events end the game into out.
+void endMessage(const Game &game, uint16_t events, char *out, size_t size) {
+	if ((events & eventDied) != 0) {
+		snprintf(out, size, "\n\nGame over.\n\n");
+	}
+	else if ((events & eventWon) != 0) {
+		snprintf(out, size, "\n\nCongradulations!!! You found your bagel!\nUnfortunately, it's stale. :(\n%sWell, you won. I hope you had fun.\n\nMoves taken: %u\n\n",
+				(game.flags & 0x10) == 0x10 ? "With a bit of cream cheese, though, it isn't too bad.\n" : "", game.moves);
+	}
+	else {
+		snprintf(out, size, "\n\nExiting...\n\n");
+	}
+}
+
+
+// Put a '!' on every free cell of the room more than 8 steps from the player, chasing on even
+// cells and copying on odd ones. Returns how many there are.
+uint32_t crowd(Game &game) {
+	uint16_t playerX = game.position % game.width;
+	uint16_t playerY = rowOf(game, game.position);
+	uint32_t count = 0;
+	for (uint8_t kind : {kindChase, kindCopy}) {
+		for (uint32_t pos = kind == kindCopy; pos < (uint32_t) game.width * game.height; pos += 2) {
+			uint16_t x = pos % game.width;
+			uint16_t y = rowOf(game, pos);
+			if (cell(game, pos) == ' ' && std::max(abs(x - playerX), abs(y - playerY)) > 8) {
+				put(game, pos, '!');
+				addEntity(game, kind, pos, 0);
+				count++;
+			}
+		}
+	}
+	scheduleEntities(game);
+	return count;
+}
+
+
+// Time turns of initializer's room, entered through door c, with the player standing still.
+// The room is entered again every 40 turns and whenever the player dies, so its entities keep
+// doing all of their work. crowded fills it with chasers and copiers first. Only the turns are timed.
+void benchmarkRoom(const char *name, uint16_t (*initializer)(Game&, char), char c, uint32_t turns, bool crowded) {
+	uint32_t id = noRoom;
+	for (const Place &place : world) {
+		if (place.id != noRoom && place.initializer == initializer) {
+			id = place.id;
+		}
+	}
+	Game game;
+	newGame(game, true);
+	uint64_t elapsed = 0;
+	uint32_t done = 0;
+	uint32_t entities = 0;
+	while (done < turns) {
+		game.roomNum = id;
+		game.entrance = c;
+		game.warp = 0;
+		game.position = enter(game, id, c);
+		uint32_t count = crowded ? crowd(game) : game.entities.first[kindCount];
+		uint64_t start = now();
+		for (uint8_t i = 0; i < 40 && done < turns; i++) {
+			done++;
+			if ((step(game, ' ') & eventDied) != 0) {
+				break;
+			}
+		}
+		elapsed += now() - start;
+		entities = count;
+	}
+	printf("%s, %u entities: %.0f ns per turn\n", name, entities, elapsed * 1e3 / (turns > 0 ? turns : 1));
+}
+
+
+// Play random keys without a terminal and report how fast the simulation runs.
+void benchmark(uint32_t turns) {
+	const char keys[] = "wasdwasdwasdwasdxerfyuiohjkl ";
+	Game game;
+	newGame(game, true);
+	uint32_t seed = 1;
+	uint32_t games = 1;
+	uint64_t start = now();
+	for (uint32_t i = 0; i < turns; i++) {
+		seed = seed * 1103515245 + 12345;
+		if ((step(game, keys[(seed >> 16) % (sizeof(keys) - 1)]) & (eventDied | eventWon)) != 0) {
+			newGame(game, true);
+			games++;
+		}
+	}
+	uint64_t elapsed = now() - start;
+	printf("%u turns over %u games in %llu us: %.0f turns per second\n", turns, games, (unsigned long long) elapsed, turns * 1e6 / (elapsed > 0 ? elapsed : 1));
+	benchmarkRoom("finalRoom", finalRoom, 'w', turns, false);
+	benchmarkRoom("wallOdeath", wallOdeath, 'a', turns, false);
+	benchmarkRoom("crowded bigRoom", bigRoom, 'w', turns / 10, true);
+}
+
+
+// Room files describe a room and which places in the world use it, so the world can be
+// changed without rebuilding the game. -c compiles them into a room atlas for -a:
+//
+//	# A comment.
+//	at 25 36 secret		Ids of the places that use this room. secret replaces the prison.
+//	link 25 w 14		Door w of place 25 leads to place 14. Doors without one stay as they were.
+//	size 10 10			Width and height, each at most 10240.
+//	grid				Followed by one line per row of the room. Short lines are padded with spaces.
+//	start * 15			Where the player starts.
+//	cell !s 45 'X'		A cell that isn't what the grid says.
+//	entity * chase 45 0	An entity of a kind in kindNames, with the position and state it starts with.
+//	teleport * 41 85	The two '*'s that lead to each other.
+//
+// After the grid, each line starts with the entrances it is for: some of ".wWaAsSdD"
+// ('.' is the start of a game), '*' for all of them, or '!' and the ones it isn't for.
+// Lines can end in "if N" or "unless N" to only count when the flag bits N are set or
+// clear. When two lines set the same thing, the later one wins. Every entity line adds one.
+struct RoomRule {
+	uint16_t doors;		// Bit i is set if the rule is for entrance atlasDoors[i].
+	uint8_t flagMask;	// Flag bits the rule checks.
+	uint8_t flagValue;	// What they have to be.
+	char kind;			// First letter of the keyword.
+	uint8_t entity;		// Kind of entity.
+	uint32_t a;			// Position or first teleporter.
+	uint32_t b;			// Cell, state or second teleporter.
+};
+
+struct RoomLink {
+	uint32_t from;		// Place the door is in.
+	uint8_t door;		// Index of the door in doorGlyphs.
+	uint32_t to;		// Place it leads to.
+};
+
+struct RoomFile {
+	std::vector<uint32_t> places;
+	std::vector<RoomLink> links;
+	uint16_t width;
+	uint16_t height;
+	std::vector<char> grid;		// width * height cells, row by row.
+	std::vector<RoomRule> rules;
+};
+
+
+// Read a number that has to be below limit. Returns false if token isn't one.
+bool parseNumber(const char *token, uint32_t limit, uint32_t *number) {
+	char *end;
+	if (token == nullptr || *token == '\0') {
+		return false;
+	}
+	unsigned long value = strtoul(token, &end, 0);
+	*number = value;
+	return *end == '\0' && value < limit;
+}
+
+
+// Read which entrances a rule is for. Returns 0 if token isn't a list of them.
+uint16_t parseDoors(const char *token) {
+	if (token == nullptr) {
+		return 0;
+	}
+	if (strcmp(token, "*") == 0) {
+		return 0x1FF;
+	}
+	bool invert = *token == '!';
+	uint16_t doors = 0;
+	for (const char *c = token + invert; *c != '\0'; c++) {
+		const char *door = strchr(atlasDoors, *c);
+		if (door == nullptr) {
+			return 0;
+		}
+		doors |= 1 << (door - atlasDoors);
+	}
+	return invert ? ~doors & 0x1FF : doors;
+}
+
+
+// Read the room file at path into room. Complains on stderr and returns false if it's broken.
+bool parseRoom(const char *path, RoomFile &room) {
+	FILE *file = fopen(path, "r");
+	if (file == nullptr) {
+		perror(path);
+		return false;
+	}
+	char *line = nullptr;	// Grid rows can be as long as the room is wide, so lines are read with getline.
+	size_t capacity = 0;
+	uint32_t lineNum = 0;
+	uint16_t row = 0;
+	bool inGrid = false;
+	const char *error = nullptr;
+	room.width = 0;
+	room.height = 0;
+	while (error == nullptr && getline(&line, &capacity, file) >= 0) {
+		lineNum++;
+		line[strcspn(line, "\r\n")] = '\0';
+		if (inGrid) {
+			size_t length = strlen(line);
+			if (length > room.width) {
+				error = "row is wider than the room";
+				break;
+			}
+			memcpy(room.grid.data() + (uint32_t) row * room.width, line, length);
+			inGrid = ++row < room.height;
+			continue;
+		}
+
+		// A quoted cell can be a space, so take it out before splitting the line up.
+		char cell = '\0';
+		char *quote = strchr(line, '\'');
+		if (quote != nullptr && quote[1] != '\0' && quote[2] == '\'') {
+			cell = quote[1];
+			memset(quote, ' ', 3);
+		}
+		char *keyword = strtok(line, " \t");
+		if (keyword == nullptr || *keyword == '#') {
+			continue;
+		}
+		uint32_t area = (uint32_t) room.width * room.height;
+		if (strcmp(keyword, "at") == 0) {
+			for (char *token = strtok(nullptr, " \t"); token != nullptr; token = strtok(nullptr, " \t")) {
+				uint32_t id = secretRoom;
+				if (strcmp(token, "secret") != 0 && !parseNumber(token, noRoom, &id)) {
+					error = "expected a place id";
+				}
+				room.places.push_back(id);
+			}
+			continue;
+		}
+		if (strcmp(keyword, "link") == 0) {
+			RoomLink link;
+			char *from = strtok(nullptr, " \t");
+			char *door = strtok(nullptr, " \t");
+			const char *glyph = door != nullptr && strlen(door) == 1 ? strchr(doorGlyphs, *door) : nullptr;
+			if (!parseNumber(from, noRoom, &link.from) || glyph == nullptr || *glyph == '\0' ||
+					!parseNumber(strtok(nullptr, " \t"), noRoom, &link.to)) {
+				error = "expected a place id, a door and another place id";
+			}
+			link.door = glyph - doorGlyphs;
+			room.links.push_back(link);
+			continue;
+		}
+		if (strcmp(keyword, "size") == 0) {
+			uint32_t width = 0;
+			uint32_t height = 0;
+			if (!parseNumber(strtok(nullptr, " \t"), maxSide + 1, &width) || !parseNumber(strtok(nullptr, " \t"), maxSide + 1, &height) ||
+					width == 0 || height == 0) {
+				error = "expected a width and a height of at most 10240";
+			}
+			room.width = width;
+			room.height = height;
+			room.grid.assign(width * height, ' ');
+			continue;
+		}
+		if (strcmp(keyword, "grid") == 0) {
+			if (area == 0) {
+				error = "grid comes before size";
+			}
+			inGrid = true;
+			continue;
+		}
+		if (row < room.height || area == 0) {
+			error = "rules have to come after the grid";
+			break;
+		}
+
+		RoomRule rule = {};
+		rule.kind = *keyword;
+		rule.doors = parseDoors(strtok(nullptr, " \t"));
+		if (rule.doors == 0) {
+			error = "expected entrances";
+			break;
+		}
+		char *first = strtok(nullptr, " \t");
+		char *second = strtok(nullptr, " \t");
+		if (strcmp(keyword, "start") == 0) {
+			if (!parseNumber(first, area, &rule.a)) {
+				error = "expected a position in the room";
+			}
+		}
+		else if (strcmp(keyword, "cell") == 0) {
+			rule.b = cell;
+			if (!parseNumber(first, area, &rule.a) || cell == '\0') {
+				error = "expected a position in the room and a quoted cell";
+			}
+		}
+		else if (strcmp(keyword, "entity") == 0) {
+			rule.entity = kindCount;
+			for (uint8_t i = 0; first != nullptr && i < kindCount; i++) {
+				if (strcmp(first, kindNames[i]) == 0) {
+					rule.entity = i;
+				}
+			}
+			if (rule.entity == kindCount || !parseNumber(second, 0xFFFFFFFF, &rule.a) ||
+					!parseNumber(strtok(nullptr, " \t"), 0xFFFFFFFF, &rule.b)) {
+				error = "expected a kind of entity, a position and a state";
+			}
+			else if ((rule.entity == kindChase || rule.entity == kindCopy) && rule.a >= area) {
+				error = "chasers and copiers have to start in the room";
+			}
+			else if (!entityFits(rule.entity, rule.a, rule.b, room.width, room.height)) {
+				error = "that entity would work on cells outside the room";
+			}
+		}
+		else if (strcmp(keyword, "teleport") == 0) {
+			if (!parseNumber(first, area, &rule.a) || !parseNumber(second, area, &rule.b)) {
+				error = "expected two positions in the room";
+			}
+		}
+		else {
+			error = "unknown keyword";
+		}
+		if (error != nullptr) {
+			break;
+		}
+
+		// What's left is an optional condition on the flags. start and cell only have one argument
+		// left after taking the quoted cell out, so for them it has been read already.
+		char *condition = rule.kind == 's' || rule.kind == 'c' ? second : strtok(nullptr, " \t");
+		if (condition != nullptr) {
+			uint32_t bits = 0;
+			bool set = strcmp(condition, "if") == 0;
+			if ((!set && strcmp(condition, "unless") != 0) || !parseNumber(strtok(nullptr, " \t"), 256, &bits) || strtok(nullptr, " \t") != nullptr) {
+				error = "expected \"if N\" or \"unless N\" at the end";
+			}
+			rule.flagMask = bits;
+			rule.flagValue = set ? bits : 0;
+		}
+		room.rules.push_back(rule);
+	}
+	free(line);
+	fclose(file);
+	if (error == nullptr && row < room.height) {
+		error = "the file ends in the middle of the grid";
+	}
+	if (error == nullptr && (room.height == 0 || room.places.empty())) {
+		error = "a room needs a size, a grid and somewhere to be";
+	}
+	if (error != nullptr) {
+		fprintf(stderr, "%s:%u: %s\n", path, lineNum, error);
+		return false;
+	}
+	return true;
+}
+
+
+// Stores terrain tiles, lists of tiles, pieces and entities for the atlas, each one only once.
+struct TileStore {
+	std::vector<uint8_t> tiles;		// terrainBytes each.
+	std::vector<uint32_t> table;
+	std::vector<Piece> pieces;
+	std::vector<AtlasEntity> entities;
+	std::unordered_multimap<uint64_t, uint32_t> tileIndex;	// Hash of a tile to 1 + its index.
+	std::unordered_multimap<uint64_t, uint32_t> tableIndex;	// Hash of a list of tiles to where it starts in table.
+	std::unordered_multimap<uint64_t, uint32_t> pieceIndex;	// Hash of a list of pieces to where it starts in pieces.
+	std::unordered_multimap<uint64_t, uint32_t> entityIndex;	// Hash of a list of entities to where it starts in entities.
+};
+
+
+// FNV-1a, for finding tiles that have been stored before.
+uint64_t hashBytes(const void *data, size_t length) {
+	const uint8_t *bytes = (const uint8_t*) data;
+	uint64_t hash = 0xCBF29CE484222325;
+	for (size_t i = 0; i < length; i++) {
+		hash = (hash ^ bytes[i]) * 0x100000001B3;
+	}
+	return hash;
+}
+
+
+// Store tile. Returns what the tile table calls it: 0 if it's blank, 1 + its index otherwise.
+uint32_t storeTile(TileStore &store, const uint8_t *tile) {
+	if (memcmp(tile, blankTile.terrain, terrainBytes) == 0) {
+		return 0;
+	}
+	uint64_t hash = hashBytes(tile, terrainBytes);
+	auto found = store.tileIndex.equal_range(hash);
+	for (auto i = found.first; i != found.second; i++) {
+		if (memcmp(store.tiles.data() + (i->second - 1) * (size_t) terrainBytes, tile, terrainBytes) == 0) {
+			return i->second;
+		}
+	}
+	store.tiles.insert(store.tiles.end(), tile, tile + terrainBytes);
+	uint32_t name = store.tiles.size() / terrainBytes;
+	store.tileIndex.emplace(hash, name);
+	return name;
+}
+
+
+// Store a list of things at the end of all, unless it's already in there. Returns where it starts.
+template <typename T>
+uint32_t storeList(std::vector<T> &all, std::unordered_multimap<uint64_t, uint32_t> &index, const std::vector<T> &list) {
+	uint64_t hash = hashBytes(list.data(), list.size() * sizeof(T));
+	auto found = index.equal_range(hash);
+	for (auto i = found.first; i != found.second; i++) {
+		if (i->second + list.size() <= all.size() && memcmp(all.data() + i->second, list.data(), list.size() * sizeof(T)) == 0) {
+			return i->second;
+		}
+	}
+	uint32_t start = all.size();
+	all.insert(all.end(), list.begin(), list.end());
+	index.emplace(hash, start);
+	return start;
+}
+
+
+// Pack the terrain of the tile in column tileX of row tileY of a room's grid into tile.
+// Cells with pieces in them get blank terrain.
+void cutTile(const RoomFile &room, uint16_t tileX, uint16_t tileY, uint8_t *tile) {
+	memset(tile, 0, terrainBytes);
+	for (uint16_t y = 0; y < tileSide && tileY * tileSide + y < room.height; y++) {
+		uint16_t x = tileX * tileSide;
+		uint16_t length = room.width - x < tileSide ? room.width - x : tileSide;
+		const char *row = room.grid.data() + (uint32_t) (tileY * tileSide + y) * room.width + x;
+		for (uint16_t i = 0; i < length; i++) {
+			uint8_t code = terrainCodes.codes[(uint8_t) row[i]];
+			setTerrain(tile, (y << tileShift) + i, code == noTerrain ? 0 : code);
+		}
+	}
+}
+
+
+// Compile the room files in paths into a room atlas at out.
+// Identical tiles, lists of tiles and pieces, and rooms are only stored once.
+bool compileRooms(const char *out, int count, char **paths) {
+	std::vector<AtlasPlace> places;
+	std::vector<AtlasRoom> rooms;
+	TileStore *store = new TileStore();
+	std::vector<RoomLink> links;
+	uint8_t *tile = new uint8_t[terrainBytes];
+	bool ok = true;
+	for (int i = 0; ok && i < count; i++) {
+		RoomFile *room = new RoomFile();
+		ok = parseRoom(paths[i], *room);
+		uint16_t across = (room->width + tileSide - 1) >> tileShift;
+		std::vector<uint32_t> grid(tileCount(room->width, room->height));
+		for (uint32_t j = 0; ok && j < grid.size(); j++) {
+			cutTile(*room, j % across, j / across, tile);
+			grid[j] = storeTile(*store, tile);
+		}
+		std::vector<Piece> gridPieces;
+		for (uint32_t j = 0; ok && j < room->grid.size(); j++) {
+			if (terrainCodes.codes[(uint8_t) room->grid[j]] == noTerrain) {
+				Piece piece = {};
+				piece.position = j;
+				piece.glyph = room->grid[j];
+				gridPieces.push_back(piece);
+			}
+		}
+		uint16_t variants[atlasVariants];
+		for (uint8_t variant = 0; ok && variant < atlasVariants; variant++) {
+			uint8_t flags = (variant & 1) != 0 ? roomFlags : 0;
+			AtlasRoom built = {};
+			built.width = room->width;
+			built.height = room->height;
+
+			std::map<uint32_t, char> cells;		// Cells that aren't what the grid says.
+			std::vector<AtlasEntity> entities;
+			for (const RoomRule &rule : room->rules) {
+				if (((rule.doors >> (variant / 2)) & 1) == 0 || (flags & rule.flagMask) != rule.flagValue) {
+					continue;
+				}
+				switch (rule.kind) {
+					case 's':
+						built.position = rule.a;
+						break;
+					case 'c':
+						cells[rule.a] = rule.b;
+						break;
+					case 'e': {
+						AtlasEntity entity = {};
+						entity.position = rule.a;
+						entity.state = rule.b;
+						entity.kind = rule.entity;
+						entities.push_back(entity);
+						break;
+					}
+					case 't':
+						built.teleport[0] = rule.a;
+						built.teleport[1] = rule.b;
+				}
+			}
+			std::stable_sort(entities.begin(), entities.end(), [](const AtlasEntity &a, const AtlasEntity &b) {
+				return a.kind < b.kind;
+			});
+
+			// Terrain goes in copies of the tiles it changes and anything else replaces the grid's pieces.
+			std::map<uint32_t, std::vector<uint8_t>> changed;
+			std::vector<Piece> pieces;
+			auto gridPiece = gridPieces.begin();
+			for (const auto &changedCell : cells) {
+				while (gridPiece != gridPieces.end() && gridPiece->position < changedCell.first) {
+					pieces.push_back(*(gridPiece++));
+				}
+				if (gridPiece != gridPieces.end() && gridPiece->position == changedCell.first) {
+					gridPiece++;
+				}
+				uint8_t code = terrainCodes.codes[(uint8_t) changedCell.second];
+				if (code == noTerrain) {
+					Piece piece = {};
+					piece.position = changedCell.first;
+					piece.glyph = changedCell.second;
+					pieces.push_back(piece);
+					continue;
+				}
+				uint16_t x = changedCell.first % room->width;
+				uint16_t y = changedCell.first / room->width;
+				uint32_t index = (y >> tileShift) * across + (x >> tileShift);
+				if (changed.count(index) == 0) {
+					changed[index].resize(terrainBytes);
+					cutTile(*room, x >> tileShift, y >> tileShift, changed[index].data());
+				}
+				setTerrain(changed[index].data(), ((y & (tileSide - 1)) << tileShift) + (x & (tileSide - 1)), code);
+			}
+			pieces.insert(pieces.end(), gridPiece, gridPieces.end());
+			std::vector<uint32_t> tiles = grid;
+			for (const auto &copy : changed) {
+				tiles[copy.first] = storeTile(*store, copy.second.data());
+			}
+			built.tiles = storeList(store->table, store->tableIndex, tiles);
+			built.pieces = storeList(store->pieces, store->pieceIndex, pieces);
+			built.pieceCount = pieces.size();
+			built.entities = storeList(store->entities, store->entityIndex, entities);
+			built.entityCount = entities.size();
+
+			size_t index = 0;
+			while (index < rooms.size() && memcmp(&rooms[index], &built, sizeof(built)) != 0) {
+				index++;
+			}
+			if (index == rooms.size()) {
+				rooms.push_back(built);
+			}
+			if (index >= 0xFFFF) {
+				fprintf(stderr, "%s: too many different rooms\n", paths[i]);
+				ok = false;
+			}
+			variants[variant] = index + 1;
+		}
+		for (size_t j = 0; ok && j < room->places.size(); j++) {
+			AtlasPlace place;
+			place.id = room->places[j];
+			for (uint32_t &door : place.doors) {
+				door = noRoom;
+			}
+			memcpy(place.variants, variants, sizeof(variants));
+			places.push_back(place);
+		}
+		links.insert(links.end(), room->links.begin(), room->links.end());
+		delete room;
+	}
+	delete[] tile;
+
+	// Sorted places make duplicates easy to spot and links quick to find their place.
+	auto byId = [](const AtlasPlace &a, const AtlasPlace &b) {
+		return a.id < b.id;
+	};
+	std::sort(places.begin(), places.end(), byId);
+	for (size_t i = 1; ok && i < places.size(); i++) {
+		if (places[i].id == places[i - 1].id) {
+			fprintf(stderr, "place %u has more than one room\n", places[i].id);
+			ok = false;
+		}
+	}
+	for (size_t i = 0; ok && i < links.size(); i++) {
+		AtlasPlace key;
+		key.id = links[i].from;
+		auto place = std::lower_bound(places.begin(), places.end(), key, byId);
+		if (place == places.end() || place->id != links[i].from) {
+			fprintf(stderr, "place %u has a link but no room\n", links[i].from);
+			ok = false;
+		}
+		else {
+			place->doors[links[i].door] = links[i].to;
+		}
+	}
+
+	AtlasHeader header = {};
+	memcpy(header.magic, "PZLATLS6", 8);
+	header.placeCount = places.size();
+	header.roomCount = rooms.size();
+	header.tableSize = store->table.size();
+	header.pieceCount = store->pieces.size();
+	header.entityCount = store->entities.size();
+	header.tileCount = store->tiles.size() / terrainBytes;
+	FILE *file = ok ? fopen(out, "wb") : nullptr;
+	if (ok && file == nullptr) {
+		perror(out);
+		ok = false;
+	}
+	if (file != nullptr) {
+		fwrite(&header, sizeof(header), 1, file);
+		fwrite(places.data(), sizeof(AtlasPlace), places.size(), file);
+		fwrite(rooms.data(), sizeof(AtlasRoom), rooms.size(), file);
+		fwrite(store->table.data(), 4, store->table.size(), file);
+		fwrite(store->pieces.data(), sizeof(Piece), store->pieces.size(), file);
+		fwrite(store->entities.data(), sizeof(AtlasEntity), store->entities.size(), file);
+		fwrite(store->tiles.data(), 1, store->tiles.size(), file);
+		ok = fclose(file) == 0;
+		printf("%s: %zu places, %zu rooms, %u tiles, %u pieces, %u entities, %zu bytes\n", out, places.size(), rooms.size(), header.tileCount,
+				header.pieceCount, header.entityCount, sizeof(header) + places.size() * sizeof(AtlasPlace) + rooms.size() * sizeof(AtlasRoom) +
+				store->table.size() * 4 + store->pieces.size() * sizeof(Piece) + store->entities.size() * sizeof(AtlasEntity) + store->tiles.size());
+	}
+	delete store;
+	return ok;
+}
+
+
+// Write rules giving every variant of a room the args in args, except for those that are
+// already blank. Whatever most variants have is written first for all of them, unless
+// some variants are blank and blank is "", which can't be written to put them back.
+void writeRules(FILE *file, const char *kind, char args[][32], const char *blank) {
+	uint8_t common = 0;
+	uint8_t most = 0;
+	bool listed = false;	// Every line lists the variants it is for.
+	for (uint8_t i = 0; i < atlasVariants; i++) {
+		uint8_t matches = 0;
+		for (uint8_t j = 0; j < atlasVariants; j++) {
+			matches += strcmp(args[i], args[j]) == 0;
+		}
+		if (matches > most) {
+			most = matches;
+			common = i;
+		}
+		listed |= *blank == '\0' && *args[i] == '\0';
+	}
+	if (!listed && strcmp(args[common], blank) != 0) {
+		fprintf(file, "%s * %s\n", kind, args[common]);
+	}
+
+	uint32_t written = 0;
+	for (uint8_t i = 0; i < atlasVariants; i++) {
+		if (strcmp(args[i], listed ? blank : args[common]) == 0 || ((written >> i) & 1) != 0) {
+			continue;
+		}
+
+		// Split the variants with these args by whether they need the flags set, clear or either.
+		uint16_t doors[3] = {0, 0, 0};
+		for (uint8_t j = i; j < atlasVariants; j++) {
+			if (strcmp(args[i], args[j]) == 0) {
+				written |= 1 << j;
+				doors[j & 1] |= 1 << (j / 2);
+			}
+		}
+		doors[2] = doors[0] & doors[1];
+		doors[0] &= ~doors[2];
+		doors[1] &= ~doors[2];
+		for (uint8_t k = 0; k < 3; k++) {
+			if (doors[k] == 0) {
+				continue;
+			}
+			char listed[16];
+			char missing[16] = "!";
+			uint8_t numListed = 0;
+			uint8_t numMissing = 1;
+			for (uint8_t door = 0; door < 9; door++) {
+				if (((doors[k] >> door) & 1) != 0) {
+					listed[numListed++] = atlasDoors[door];
+				}
+				else {
+					missing[numMissing++] = atlasDoors[door];
+				}
+			}
+			listed[numListed] = '\0';
+			missing[numMissing] = '\0';
+			const char *selector = numMissing == 1 ? "*" : numMissing <= numListed ? missing : listed;
+			const char *condition = k == 0 ? " unless" : k == 1 ? " if" : "";
+			fprintf(file, "%s %s %s", kind, selector, args[i]);
+			if (k < 2) {
+				fprintf(file, "%s %u", condition, roomFlags);
+			}
+			fprintf(file, "\n");
+		}
+	}
+}
+
+
+// Write every built-in room out as a room file in dir, as a starting point for new ones.
+bool exportRooms(const char *dir) {
+	for (const auto &named : roomNames) {
+		std::vector<uint32_t> ids;
+		for (const Place &place : world) {
+			if (place.id != noRoom && place.initializer == named.initializer) {
+				ids.push_back(place.id);
+			}
+		}
+		if (ids.empty()) {
+			continue;
+		}
+		std::sort(ids.begin(), ids.end());
+
+		// Build every variant in a blank game, like buildSnapshot() does.
+		Game *variants = new Game[atlasVariants]();
+		uint16_t positions[atlasVariants];
+		for (uint8_t i = 0; i < atlasVariants; i++) {
+			variants[i].flags = (i & 1) != 0 ? roomFlags : 0;
+			positions[i] = named.initializer(variants[i], i < 2 ? ' ' : atlasDoors[i / 2]);
+		}
+		uint8_t width = variants[0].width;
+		uint32_t area = (uint32_t) width * variants[0].height;
+
+		char path[512];
+		snprintf(path, sizeof(path), "%s/%s.room", dir, named.name);
+		FILE *file = fopen(path, "w");
+		if (file == nullptr) {
+			perror(path);
+			delete[] variants;
+			return false;
+		}
+		fprintf(file, "# %s\nat", named.name);
+		for (uint32_t id : ids) {
+			if (id == secretRoom) {
+				fprintf(file, " secret");
+			}
+			else {
+				fprintf(file, " %u", id);
+			}
+		}
+		fprintf(file, "\n");
+
+		// Only doors that are actually in the room get a link.
+		for (uint32_t id : ids) {
+			const Place *place = findPlace(id);
+			for (uint8_t door = 0; door < 8; door++) {
+				bool used = false;
+				for (uint8_t i = 0; i < atlasVariants && !used; i++) {
+					for (uint32_t j = 0; j < area && !used; j++) {
+						used = cell(variants[i], j) == doorGlyphs[door];
+					}
+				}
+				if (used && place->doors[door] != noRoom) {
+					fprintf(file, "link %u %c %u\n", id, doorGlyphs[door], place->doors[door]);
+				}
+			}
+		}
+		fprintf(file, "size %u %u\ngrid\n", width, variants[0].height);
+
+		// The grid has whatever most variants have in each cell.
+		std::vector<char> grid(area);
+		for (uint32_t i = 0; i < area; i++) {
+			uint8_t most = 0;
+			for (uint8_t j = 0; j < atlasVariants; j++) {
+				uint8_t matches = 0;
+				for (uint8_t k = 0; k < atlasVariants; k++) {
+					matches += cell(variants[j], i) == cell(variants[k], i);
+				}
+				if (matches > most) {
+					most = matches;
+					grid[i] = cell(variants[j], i);
+				}
+			}
+		}
+		for (uint16_t row = 0; row < variants[0].height; row++) {
+			int length = width;
+			while (length > 0 && grid[(uint32_t) row * width + length - 1] == ' ') {
+				length--;
+			}
+			fprintf(file, "%.*s\n", length, grid.data() + (uint32_t) row * width);
+		}
+
+		char args[atlasVariants][32];
+		char blank[32];
+		for (uint8_t i = 0; i < atlasVariants; i++) {
+			snprintf(args[i], 32, "%u", positions[i]);
+		}
+		writeRules(file, "start", args, "");
+		for (uint32_t index = 0; index < area; index++) {
+			for (uint8_t i = 0; i < atlasVariants; i++) {
+				snprintf(args[i], 32, "%u '%c'", index, cell(variants[i], index));
+			}
+			snprintf(blank, 32, "%u '%c'", index, grid[index]);
+			writeRules(file, "cell", args, blank);
+		}
+
+		// Entities are written in order, so the nth entity line of each variant makes its nth entity.
+		uint32_t entityCount = 0;
+		for (uint8_t i = 0; i < atlasVariants; i++) {
+			entityCount = std::max(entityCount, variants[i].entities.first[kindCount]);
+		}
+		for (uint32_t index = 0; index < entityCount; index++) {
+			for (uint8_t i = 0; i < atlasVariants; i++) {
+				const Entities &entities = variants[i].entities;
+				uint8_t kind = 0;
+				while (kind < kindCount && entities.first[kind + 1] <= index) {
+					kind++;
+				}
+				args[i][0] = '\0';
+				if (kind < kindCount) {
+					snprintf(args[i], 32, "%s %u %u", kindNames[kind], entities.position[index], entities.state[index]);
+				}
+			}
+			writeRules(file, "entity", args, "");
+		}
+		for (uint8_t i = 0; i < atlasVariants; i++) {
+			snprintf(args[i], 32, "%u %u", variants[i].teleport[0], variants[i].teleport[1]);
+		}
+		writeRules(file, "teleport", args, "0 0");
+		fclose(file);
+		delete[] variants;
+	}
+	return true;
+}
+
+
+#ifdef __linux__
+
+// Where a connected player is in the game.
+const uint8_t sessionWelcome = 0;	// Reading the welcome text.
+const uint8_t sessionPlaying = 1;
+const uint8_t sessionPaused = 2;	// Reading a pickup message.
+const uint8_t sessionClosing = 3;	// The game is over and the last output is draining.
+
+
+// One player connected to the server.
+struct Session {
+	int fd;				// The player's connection.
+	uint8_t state;		// One of the session constants.
+	uint8_t telnet;		// Where we are in a telnet command the client sent. 0 outside of one.
+	uint8_t escape;		// Where we are in an escape sequence the client sent. 0 outside of one.
+	bool framePending;	// The newest frame is waiting for the connection to drain.
+	char *queue;		// Output the connection couldn't take yet, or nullptr.
+	uint32_t queued;	// Bytes in queue.
+	uint32_t sent;		// Bytes of queue already sent.
+	Game game;
+	Screen screen;
+};
+
+
+// Send as much of buf as the connection takes without blocking and queue the rest.
+// Anything already queued goes first. Returns false if the connection is broken.
+bool transmit(Session &session, const char *buf, uint32_t length) {
+	if (session.queue == nullptr) {
+		while (length > 0) {
+			ssize_t written = send(session.fd, buf, length, MSG_NOSIGNAL);
+			if (written < 0) {
+				if (errno == EINTR) {
+					continue;
+				}
+				if (errno != EAGAIN && errno != EWOULDBLOCK) {
+					return false;
+				}
+				break;
+			}
+			buf += written;
+			length -= written;
+		}
+		if (length == 0) {
+			return true;
+		}
+	}
+	char *queue = (char*) realloc(session.queue, session.queued + length);
+	if (queue == nullptr) {
+		return false;
+	}
+	memcpy(queue + session.queued, buf, length);
+	session.queue = queue;
+	session.queued += length;
+	return true;
+}
+
+
+// Send whatever is queued for the connection. Returns false if the connection is broken.
+bool drain(Session &session) {
+	while (session.sent < session.queued) {
+		ssize_t written = send(session.fd, session.queue + session.sent, session.queued - session.sent, MSG_NOSIGNAL);
+		if (written < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return errno == EAGAIN || errno == EWOULDBLOCK;
+		}
+		session.sent += written;
+	}
+	free(session.queue);
+	session.queue = nullptr;
+	session.queued = 0;
+	session.sent = 0;
+	return true;
+}
+
+
+// Send text, turning "\n" into "\r\n" since nothing on the way does that for us.
+bool transmitText(Session &session, const char *text) {
+	char buf[1024];
+	uint32_t length = 0;
+	for (; *text != '\0'; text++) {
+		if (*text == '\n') {
+			buf[length++] = '\r';
+		}
+		buf[length++] = *text;
+		if (length > sizeof(buf) - 2) {
+			if (!transmit(session, buf, length)) {
+				return false;
+			}
+			length = 0;
+		}
+	}
+	return transmit(session, buf, length);
+}
+
+
+// Send the newest frame if the connection has taken everything before it. Otherwise, if
+// coalesce is set, hold it back so that only the newest state is sent once the connection drains.
+bool transmitFrame(Session &session, bool coalesce) {
+	if (coalesce && session.queue != nullptr) {
+		session.framePending = true;
+		return true;
+	}
+	char buf[frameSize];
+	session.framePending = false;
+	return transmit(session, buf, compose(session.game, session.screen, buf) - buf);
+}
+
+
+// Act on one key from the player. Returns false if the connection is broken.
+bool play(Session &session, char key) {
+	switch (session.state) {
+		case sessionWelcome:
+			newGame(session.game, key == 'C');
+			session.state = sessionPlaying;
+			redraw(session.screen);
+			return transmit(session, "\033[?1049h\033[?25l", 14);
+		case sessionPaused:
+			session.state = sessionPlaying;
+			redraw(session.screen);
+			return true;
+		case sessionClosing:
+			return true;
+	}
+	uint16_t events = step(session.game, key);
+	if ((events & eventRoom) != 0) {
+		redraw(session.screen);
+	}
+	if ((events & (eventDied | eventWon | eventQuit)) != 0) {
+
+		// Go back to the normal screen and leave the last frame and the ending there.
+		char message[512];
+		endMessage(session.game, events, message, sizeof(message));
+		session.state = sessionClosing;
+		redraw(session.screen);
+		return transmit(session, "\033[?25h\033[?1049l", 14) && transmitFrame(session, false) && transmitText(session, message);
+	}
+	const char *message = pickupMessage(events);
+	if (message != nullptr) {
+		session.state = sessionPaused;
+		return transmitText(session, message);
+	}
+	return true;
+}
+
+
+// Act on a burst of input from the player, then draw the result once.
+// Returns false if the connection is broken.
+bool receive(Session &session, const char *buf, ssize_t length) {
+	for (ssize_t i = 0; i < length; i++) {
+		unsigned char c = buf[i];
+
+		// Skip telnet commands: IAC, a command byte, an option byte for WILL/WONT/DO/DONT,
+		// and everything up to IAC SE for subnegotiations.
+		if (session.telnet != 0) {
+			if (session.telnet == 1) {
+				session.telnet = c == 250 ? 3 : (c >= 251 && c <= 254 ? 2 : 0);
+				if (c != 255) {
+					continue;
+				}
+			}
+			else if (session.telnet == 2) {
+				session.telnet = 0;
+				continue;
+			}
+			else {
+				session.telnet = c == 255 ? 4 : (session.telnet == 4 && c == 240 ? 0 : 3);
+				continue;
+			}
+		}
+		else if (c == 255) {
+			session.telnet = 1;
+			continue;
+		}
+		if (c == '\0') {
+			continue;	// Telnet sends "\r\0" for the enter key.
+		}
+
+		// Arrow keys come in as ESC [ or ESC O, optional parameters and a final byte.
+		if (session.escape == 1) {
+			if (c == '[' || c == 'O') {
+				session.escape = 2;
+				continue;
+			}
+			session.escape = 0;
+			if (!play(session, '\033')) {
+				return false;
+			}
+		}
+		else if (session.escape == 2) {
+			if (c >= 0x40 && c <= 0x7E) {
+				session.escape = 0;
+				if (!play(session, arrowKey(c))) {
+					return false;
+				}
+			}
+			continue;
+		}
+		if (c == '\033') {
+			session.escape = 1;
+			continue;
+		}
+		if (!play(session, c)) {
+			return false;
+		}
+	}
+	if (session.state == sessionPlaying) {
+		return transmitFrame(session, true);
+	}
+	return true;
+}
+
+
+// Start a session for a player who just connected.
+Session *openSession(int fd, bool telnet) {
+	Session *session = new Session();
+	session->fd = fd;
+	session->screen.crlf = true;
+	fitScreen(session->screen, defaultViewWidth, defaultViewHeight);
+	if (telnet) {
+		const char negotiation[] = {(char) 255, (char) 251, 1, (char) 255, (char) 251, 3};	// IAC WILL ECHO, IAC WILL SUPPRESS-GO-AHEAD.
+		transmit(*session, negotiation, sizeof(negotiation));
+	}
+	transmitText(*session, welcome);
+	return session;
+}
+
+
+// Hang up on a player.
+void closeSession(Session *session) {
+	close(session->fd);
+	free(session->queue);
+	delete session;
+}
+
+
+// Run games for the connections on listener until the process is killed.
+// Every thread runs one of these with its own epoll instance.
+void serve(int listener, bool telnet) {
+	int poller = epoll_create1(EPOLL_CLOEXEC);
+	epoll_event event = {};
+	event.events = EPOLLIN | EPOLLEXCLUSIVE;	// Only wake one thread per new connection.
+	event.data.ptr = nullptr;
+	epoll_ctl(poller, EPOLL_CTL_ADD, listener, &event);
+	epoll_event events[64];
+	int spare = open("/dev/null", O_RDONLY | O_CLOEXEC);	// Given up to hang up on connections when out of descriptors.
+	while (true) {
+		int count = epoll_wait(poller, events, 64, -1);
+		for (int i = 0; i < count; i++) {
+			Session *session = (Session*) events[i].data.ptr;
+
+			// Take every waiting connection. Other threads may get to some of them first.
+			if (session == nullptr) {
+				int fd;
+				while ((fd = accept4(listener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+					session = openSession(fd, telnet);
+					event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+					event.data.ptr = session;
+					epoll_ctl(poller, EPOLL_CTL_ADD, fd, &event);
+				}
+
+				// Out of descriptors, the connection stays waiting and epoll keeps waking for it,
+				// so free the spare one for long enough to take it and hang up.
+				if ((errno == EMFILE || errno == ENFILE) && spare >= 0) {
+					perror("accept");
+					close(spare);
+					fd = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+					if (fd >= 0) {
+						close(fd);
+					}
+					spare = open("/dev/null", O_RDONLY | O_CLOEXEC);
+				}
+				continue;
+			}
+
+			// Edge triggered, so read until there's nothing left.
+			bool alive = true;
+			if ((events[i].events & EPOLLIN) != 0) {
+				char buf[1024];
+				while (alive) {
+					ssize_t length = recv(session->fd, buf, sizeof(buf), 0);
+					if (length > 0) {
+						alive = receive(*session, buf, length);
+					}
+					else if (length == 0) {
+						alive = false;	// The player hung up.
+					}
+					else if (errno != EINTR) {
+						alive = errno == EAGAIN || errno == EWOULDBLOCK;
+						break;
+					}
+				}
+			}
+			if ((events[i].events & (EPOLLERR | EPOLLHUP)) != 0) {
+				alive = false;
+			}
+
+			// Send what's queued and, once the connection has caught up, the newest frame.
+			if (alive) {
+				alive = drain(*session);
+			}
+			if (alive && session->framePending && session->queue == nullptr) {
+				alive = transmitFrame(*session, true);
+			}
+			if (!alive || (session->state == sessionClosing && session->queue == nullptr)) {
+				closeSession(session);
+			}
+		}
+	}
+}
+
+
+// Serve games over TCP on port (tcp set) or on the Unix socket at path, with one event loop per core.
+int server(bool tcp, const char *address) {
+	int listener;
+	if (tcp) {
+		listener = socket(AF_INET6, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+		int no = 0;
+		int yes = 1;
+		setsockopt(listener, IPPROTO_IPV6, IPV6_V6ONLY, &no, sizeof(no));	// Take IPv4 too.
+		setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+		sockaddr_in6 addr = {};
+		addr.sin6_family = AF_INET6;
+		addr.sin6_addr = in6addr_any;
+		addr.sin6_port = htons(atoi(address));
+		if (bind(listener, (sockaddr*) &addr, sizeof(addr)) != 0) {
+			perror("bind");
+			return 1;
+		}
+	}
+	else {
+		listener = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+		sockaddr_un addr = {};
+		addr.sun_family = AF_UNIX;
+		strncpy(addr.sun_path, address, sizeof(addr.sun_path) - 1);
+
+		// Clear away a socket left over from an earlier run, but never anything else that's there.
+		struct stat info;
+		if (lstat(address, &info) == 0 && S_ISSOCK(info.st_mode)) {
+			unlink(address);
+		}
+		if (bind(listener, (sockaddr*) &addr, sizeof(addr)) != 0) {
+			perror("bind");
+			return 1;
+		}
+	}
+	if (listen(listener, SOMAXCONN) != 0) {
+		perror("listen");
+		return 1;
+	}
+	long cores = sysconf(_SC_NPROCESSORS_ONLN);
+	std::vector<std::thread> loops;
+	for (long i = 1; i < cores; i++) {
+		loops.emplace_back(serve, listener, tcp);
+	}
+	serve(listener, tcp);
+	return 0;
+}
+
+#else
+
+// The server is built on epoll, which only Linux has.
+int server(bool tcp, const char *address) {
+	fprintf(stderr, "Server mode is only available on Linux.\n");
+	return 1;
+}
+
+#endif
+
+
+#ifdef __linux__
+
+// Start the tick timer, first going off a tick from now. Stopped if rate is 0.
+// Returns when it was started, which ticks are counted from.
+uint64_t armTicks(int timer, uint32_t rate) {
+	itimerspec spec = {};
+	if (rate != 0) {
+		spec.it_interval.tv_sec = 1 / rate;
+		spec.it_interval.tv_nsec = 1000000000 / rate % 1000000000;
+		spec.it_value = spec.it_interval;
+	}
+	timerfd_settime(timer, 0, &spec, nullptr);
+	return now();
+}
+
+
+// Play with the room moving on by itself rate times a second, whether or not keys come.
+// Each tick acts on one waiting key, or on noKey if there isn't one. Input is read as it
+// arrives, and frames are drawn once the ticks that were due have run, so drawing never
+// holds up the simulation. When no key is waiting and nothing in the room is due, the
+// timer is stopped until a key comes in. Returns the events that ended the game.
+uint16_t playRealTime(Game &game, uint32_t rate) {
+	int timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (timer < 0) {
+		perror("timerfd_create");
+		return eventQuit;
+	}
+	tickRate = rate;
+	rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	uint64_t cpuStart = (uint64_t) (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000 + usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+	uint64_t start = now();
+	uint64_t armed = armTicks(timer, rate);
+	uint64_t ticks = 0;		// Ticks since the timer was armed.
+	bool asleep = false;
+	uint16_t events = 0;
+	print(game);
+	while ((events & (eventDied | eventWon | eventQuit)) == 0) {
+		if (resized) {
+			resized = 0;
+			measureTerminal();
+			print(game);
+		}
+
+		// Negative fds are left out, so closed input or a full key ring isn't waited on.
+		bool listening = !inputClosed && keysWritten - keysRead < sizeof(keys);
+		pollfd fds[3] = {{timer, POLLIN, 0}, {listening ? STDIN_FILENO : -1, POLLIN, 0}, {framePending ? STDOUT_FILENO : -1, POLLOUT, 0}};
+		if (poll(fds, 3, -1) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			break;
+		}
+		if (fds[1].revents != 0) {
+			readKeys(0);
+			if (asleep) {
+				asleep = false;
+				armed = armTicks(timer, rate);
+				ticks = 0;
+			}
+		}
+		if (fds[2].revents != 0) {
+			render(game);
+		}
+		uint64_t due;
+		if (fds[0].revents == 0 || read(timer, &due, sizeof(due)) != sizeof(due)) {
+			continue;
+		}
+
+		// How late the newest tick is, measured from when it was due. armed is read just after
+		// the timer is started, so a tick that's right on time can look a little early.
+		ticks += due;
+		int64_t early = (int64_t) (armed + ticks * 1000000 / rate) - (int64_t) now();
+		uint64_t late = early < 0 ? -early : 0;
+		ticksRun += due;
+		ticksMissed += due - 1;
+		tickLateTotal += late;
+		if (late > tickLateMax) {
+			tickLateMax = late;
+		}
+
+		// Every tick that came due is run, so the room keeps to the clock even when the process fell behind.
+		for (uint64_t i = 0; i < due && (events & (eventDied | eventWon | eventQuit)) == 0; i++) {
+			char key = keysWritten != keysRead ? readKey() : inputClosed ? 't' : noKey;
+			events = step(game, key);
+			if ((events & eventRoom) != 0) {
+				redraw(terminal);
+			}
+			const char *message = pickupMessage(events);
+			if (message != nullptr) {
+				print(game);
+				printf("%s", message);
+				fflush(stdout);
+				readKey();
+				redraw(terminal);
+				armed = armTicks(timer, rate);	// Time stands still while the message is up.
+				ticks = 0;
+				break;
+			}
+		}
+		if (keysWritten == keysRead && entitiesIdle(game)) {
+			asleep = true;
+			armTicks(timer, 0);
+		}
+		print(game);
+	}
+	getrusage(RUSAGE_SELF, &usage);
+	tickCpu = (uint64_t) (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000 + usage.ru_utime.tv_usec + usage.ru_stime.tv_usec - cpuStart;
+	tickWall = now() - start;
+	close(timer);
+	return events;
+}
+
+#else
+
+// Real-time mode ticks on a timerfd, which only Linux has. main() doesn't let it get this far.
+uint16_t playRealTime(Game &game, uint32_t rate) {
+	return eventQuit;
+}
+
+#endif
+
+
+// Print some performance counters for the session that just ended.
+void printStats() {
+	printf("Frames skipped: %u\n", framesSkipped);
+	printf("Rooms: %u from the cache, %u built while waiting, %u prefetched\n", roomsCached, roomsBuilt, roomsPrefetched);
+	if (latencyFrames > 0) {
+		printf("Input latency: %llu us average, %llu us worst\n", (unsigned long long) (latencyTotal / latencyFrames), (unsigned long long) latencyMax);
+	}
+	if (tickRate != 0 && ticksRun > 0) {
+		printf("Ticks at %u Hz: %llu, %llu missed, %llu us late on average, %llu us worst\n", tickRate, (unsigned long long) ticksRun,
+				(unsigned long long) ticksMissed, (unsigned long long) (tickLateTotal / ticksRun), (unsigned long long) tickLateMax);
+		printf("CPU: %.2f%% of %.1f s\n", tickCpu * 100.0 / (tickWall > 0 ? tickWall : 1), tickWall / 1e6);
+	}
+}
+
+
+int main(int argc, char **argv) {
+
+	// Options can come in any order. Every one but -s takes a value, and -c takes the rest of the
+	// arguments as well. Of -x, -c, -b, -l and -u, the last one given is what's done instead of playing.
+	const char *atlas = nullptr;	// Room atlas to play with instead of the built-in rooms.
+	char mode = '\0';
+	const char *target = nullptr;	// The value of the mode's option.
+	int sources = 0;		// Room files for -c.
+	char **sourcePaths = nullptr;
+	uint32_t rate = 0;		// Turns per second in real-time mode.
+	bool stats = false;		// Report performance counters on exit.
+	for (int i = 1; i < argc; i++) {
+		const char *arg = argv[i];
+		char option = arg[0] == '-' && arg[1] != '\0' && arg[2] == '\0' ? arg[1] : '\0';
+		if (option == 's') {
+			stats = true;
+			continue;
+		}
+		if (option == '\0' || strchr("axcblur", option) == nullptr) {
+			fprintf(stderr, "%s: unknown option\n", arg);
+			return 1;
+		}
+		if (i + 1 == argc || (option == 'c' && i + 2 == argc)) {
+			fprintf(stderr, "%s needs %s\n", arg, option == 'c' ? "an atlas and room files" : "a value");
+			return 1;
+		}
+		const char *value = argv[++i];
+		if (option == 'a') {
+			atlas = value;
+		}
+		else if (option == 'r') {
+#ifndef __linux__
+			fprintf(stderr, "Real-time mode is only available on Linux.\n");
+			return 1;
+#endif
+			rate = strtoul(value, nullptr, 10);
+			if (rate == 0 || rate > 1000) {
+				fprintf(stderr, "-r takes a rate of 1 to 1000 turns per second\n");
+				return 1;
+			}
+		}
+		else {
+			mode = option;
+			target = value;
+			if (option == 'c') {
+				sources = argc - i - 1;
+				sourcePaths = argv + i + 1;
+				break;
+			}
+		}
+	}
+
+	buildWorld();
+	if (atlas != nullptr && !loadAtlas(atlas)) {
+		return 1;
+	}
+	switch (mode) {
+		case 'x':
+			return exportRooms(target) ? 0 : 1;
+		case 'c':
+			return compileRooms(target, sources, sourcePaths) ? 0 : 1;
+		case 'b':
+			benchmark(strtoul(target, nullptr, 10));
+			return 0;
+		case 'l':
+		case 'u':
+			return server(mode == 'l', target);
+	}
+	printf("%s", welcome);
+	Game game;
+	newGame(game, readKey() == 'C');
+	rawMode();
+	measureTerminal();
+	signal(SIGWINCH, onResize);
+	enterScreen();
+	uint16_t events = rate != 0 ? playRealTime(game, rate) : 0;
+	while ((events & (eventDied | eventWon | eventQuit)) == 0) {
+
+		// Only draw once every key that is already waiting has been acted on.
+		if (keysPending()) {
+			framesSkipped++;
+		}
+		else {
+			print(game);
+		}
+		awaitInput(game);
+		events = step(game, readKey());
+		if ((events & eventRoom) != 0) {
+			redraw(terminal);
+		}
+		const char *message = pickupMessage(events);
+		if (message != nullptr) {
+			printf("%s", message);
+			readKey();
+			redraw(terminal);
+		}
+	}
+	char message[512];
+	endMessage(game, events, message, sizeof(message));
+	leaveScreen(game);
+	printf("%s", message);
+	if (stats) {
+		printStats();
+	}
+	if ((events & eventDied) != 0) {
+		return 1;
+	}
+	return (events & eventWon) != 0 ? 2 : 0;
+}